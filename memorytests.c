@@ -5,10 +5,47 @@
 #include <assert.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
 
 #include "mymem.h"
+#include "mymem_bitmap.h"
 #include "testrunner.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycles"
+static unsigned long long bench_clock() { return __rdtsc(); }
+#else
+#define BENCH_UNIT "ns"
+static unsigned long long bench_clock()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+#endif
+
+/* pool settings used by the randomized tests */
+static struct mem_options testOptions;
+
+/* Buddy rounds every size up to a power of two, so tests that count exact
+ * bytes and holes skip it and leave it to test_buddy. The boundary-tag
+ * layout has no buddy system at all, so that pairing is skipped everywhere.
+ */
+static int skip_if_buddy(strategies strategy)
+{
+	return strategy == Buddy;
+}
+
+static int skip_if_unsupported(strategies strategy, layouts layout)
+{
+	return strategy == Buddy && layout == TagLayout;
+}
+
 /* performs a randomized test:
 	totalSize == the total size of the memory pool, as passed to initmem2
 		totalSize must be less than 10,000 * minBlockSize
@@ -23,7 +60,7 @@ void do_randomized_test(int strategyToUse, int totalSize, float fillRatio, int m
 	int storedPointers = 0;
 	int strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 	int smallBlockSize = maxBlockSize / 10;
 
 	if (strategyToUse > 0)
@@ -37,23 +74,29 @@ void do_randomized_test(int strategyToUse, int totalSize, float fillRatio, int m
 		return;
 	}
 
-	fprintf(log, "Running randomized tests: pool size == %d, fill ratio == %f, block size is from %d to %d, %d iterations\n", totalSize, fillRatio, minBlockSize, maxBlockSize, iterations);
+	fprintf(log, "Running randomized tests: pool size == %d, fill ratio == %f, block size is from %d to %d, %d iterations, %s layout, %zu-byte alignment%s\n", totalSize, fillRatio, minBlockSize, maxBlockSize, iterations, layout_name(testOptions.layout), testOptions.alignment ? testOptions.alignment : 1, testOptions.lazy_coalesce ? ", lazy coalescing" : "");
 
 	fclose(log);
 
 	for (strategy = lbound; strategy <= ubound; strategy++)
 	{
 		double sum_largest_free = 0;
+		double sum_wasted = 0;
 		double sum_hole_size = 0;
+		double sum_holes = 0;
 		double sum_allocated = 0;
 		int failed_allocations = 0;
 		double sum_small = 0;
+		double sum_overhead = 0;
 		struct timespec execstart, execend;
 		int force_free = 0;
 		int i;
 		storedPointers = 0;
 
-		initmem(strategy, totalSize);
+		if (skip_if_unsupported(strategy, testOptions.layout))
+			continue;
+
+		initmem_opts(strategy, totalSize, &testOptions);
 
 		clock_gettime(CLOCK_REALTIME, &execstart);
 
@@ -95,9 +138,13 @@ void do_randomized_test(int strategyToUse, int totalSize, float fillRatio, int m
 			}
 
 			sum_largest_free += mem_largest_free();
-			sum_hole_size += (mem_free() / mem_holes());
+			if (mem_holes() > 0) /* a completely full pool has no holes */
+				sum_hole_size += (mem_free() / mem_holes());
+			sum_holes += mem_holes();
 			sum_allocated += mem_allocated();
 			sum_small += mem_small_free(smallBlockSize);
+			sum_overhead += mem_overhead();
+			sum_wasted += mem_internal_fragmentation();
 		}
 
 		clock_gettime(CLOCK_REALTIME, &execend);
@@ -111,22 +158,21 @@ void do_randomized_test(int strategyToUse, int totalSize, float fillRatio, int m
 
 		fprintf(log, "\t=== %s ===\n", strategy_name(strategy));
 		fprintf(log, "\tTest took %.2fms.\n", (execend.tv_sec - execstart.tv_sec) * 1000 + (execend.tv_nsec - execstart.tv_nsec) / 1000000.0);
+		fprintf(log, "\tAverage number of holes: %f\n", sum_holes / iterations);
 		fprintf(log, "\tAverage hole size: %f\n", sum_hole_size / iterations);
 		fprintf(log, "\tAverage largest free block: %f\n", sum_largest_free / iterations);
 		fprintf(log, "\tAverage allocated bytes: %f\n", sum_allocated / iterations);
 		fprintf(log, "\tAverage number of small blocks: %f\n", sum_small / iterations);
 		fprintf(log, "\tFailed allocations: %d\n", failed_allocations);
+		fprintf(log, "\tAverage metadata overhead: %f bytes\n", sum_overhead / iterations);
+		fprintf(log, "\tAverage internal fragmentation: %f bytes\n", sum_wasted / iterations);
 		fclose(log);
 	}
 }
 
 /* run randomized tests against the various strategies with various parameters */
-int do_stress_tests(int argc, char **argv)
+static void run_stress_suite(int strategy)
 {
-	int strategy = strategyFromString(*(argv + 1));
-
-	unlink("tests.log"); // We want a new log file
-
 	do_randomized_test(strategy, 10000, 0.25, 1, 1000, 10000);
 	do_randomized_test(strategy, 10000, 0.25, 1, 2000, 10000);
 	do_randomized_test(strategy, 10000, 0.25, 1000, 2000, 10000);
@@ -148,22 +194,325 @@ int do_stress_tests(int argc, char **argv)
 	do_randomized_test(strategy, 10000, 0.75, 1, 2000, 10000);
 
 	do_randomized_test(strategy, 10000, 0.9, 1, 500, 10000);
+}
+
+int do_stress_tests(int argc, char **argv)
+{
+	unlink("tests.log"); // We want a new log file
+
+	run_stress_suite(strategyFromString(*(argv + 1)));
 
 	return 0; /* you nominally pass for surviving without segfaulting */
 }
 
+/* the same randomized tests with boundary tags in the pool, appended to the log */
+int do_stress_tests_tags(int argc, char **argv)
+{
+	testOptions.layout = TagLayout;
+
+	run_stress_suite(strategyFromString(*(argv + 1)));
+
+	return 0;
+}
+
+/* the same randomized tests with 16- and 64-byte aligned blocks, appended to the
+ * log; compare their fragmentation and run times with the unaligned runs */
+int do_stress_tests_aligned(int argc, char **argv)
+{
+	size_t alignments[] = {16, 64};
+
+	testOptions.layout = ListLayout;
+	for (int i = 0; i < 2; i++)
+	{
+		testOptions.alignment = alignments[i];
+		run_stress_suite(strategyFromString(*(argv + 1)));
+	}
+	testOptions.alignment = 0;
+
+	return 0;
+}
+
+/* the same randomized tests with lazy coalescing, appended to the log; compare
+ * their hole counts and run times with the plain stress runs */
+int do_stress_tests_lazy(int argc, char **argv)
+{
+	testOptions.layout = ListLayout;
+	testOptions.lazy_coalesce = 64;
+	run_stress_suite(strategyFromString(*(argv + 1)));
+	testOptions.lazy_coalesce = 0;
+
+	return 0;
+}
+
+#define BENCH_SLOTS 4096
+#define BENCH_OPS 100000
+#define BENCH_RUNS 3
+
+static int compare_samples(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+	return (x > y) - (x < y);
+}
+
+/* time every single mymalloc and myfree with thousands of live blocks, and log
+   the mean, 99.9th percentile and worst case per strategy to tests.log; the same
+   operation sequence is replayed BENCH_RUNS times and each operation keeps its
+   fastest run, so interrupts and preemption drop out while costs the allocator
+   pays every time (growing its tables, say) still show */
+int do_latency_benchmark(int argc, char **argv)
+{
+	static void *blocks[BENCH_SLOTS];
+	static unsigned long long samples[BENCH_OPS];
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	FILE *log = fopen("tests.log", "a");
+	if (log == NULL)
+	{
+		perror("Can't append to log file.\n");
+		return 1;
+	}
+	fprintf(log, "Latency benchmark: pool size == %d, %d slots, block size is from 1 to 512, %d operations, best of %d runs, " BENCH_UNIT " per operation\n", 1 << 22, BENCH_SLOTS, BENCH_OPS, BENCH_RUNS);
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		double sum = 0;
+		int failed = 0;
+		int i, run;
+
+		for (run = 0; run < BENCH_RUNS; run++)
+		{
+			unsigned int seed = 1;
+
+			initmem(strategy, 1 << 22);
+			memset(blocks, 0, sizeof(blocks));
+			failed = 0;
+
+			for (i = 0; i < BENCH_OPS; i++)
+			{
+				int slot = rand_r(&seed) % BENCH_SLOTS;
+				int size = rand_r(&seed) % 512 + 1;
+				unsigned long long start = bench_clock();
+				unsigned long long elapsed;
+
+				if (blocks[slot])
+				{
+					myfree(blocks[slot]);
+					blocks[slot] = NULL;
+				}
+				else
+				{
+					blocks[slot] = mymalloc(size);
+					failed += !blocks[slot];
+				}
+
+				elapsed = bench_clock() - start;
+				if (run == 0 || elapsed < samples[i])
+					samples[i] = elapsed;
+			}
+		}
+
+		for (i = 0; i < BENCH_OPS; i++)
+			sum += samples[i];
+		qsort(samples, BENCH_OPS, sizeof(samples[0]), compare_samples);
+		fprintf(log, "\t%-7s mean %8.1f  99.9%% %8llu  worst %10llu  (%d failed allocations)\n", strategy_name(strategy), sum / BENCH_OPS, samples[BENCH_OPS * 999 / 1000], samples[BENCH_OPS - 1], failed);
+	}
+
+	fclose(log);
+	return 0;
+}
+
+#define BATCH_SIZE 32
+#define BATCH_ROUNDS 4000
+
+/* n mymalloc and n myfree calls against one mymalloc_batch and one
+ * myfree_batch, on a pool that is fragmented by long-lived blocks first */
+int do_batch_benchmark(int argc, char **argv)
+{
+	static void *background[BENCH_SLOTS];
+	void *blocks[BATCH_SIZE];
+	size_t sizes[BATCH_SIZE];
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	FILE *log = fopen("tests.log", "a");
+	if (log == NULL)
+	{
+		perror("Can't append to log file.\n");
+		return 1;
+	}
+	fprintf(log, "Batch benchmark: pool size == %d, %d batches of %d blocks from 1 to 256 bytes, " BENCH_UNIT " per block\n", 1 << 22, BATCH_ROUNDS, BATCH_SIZE);
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		unsigned long long single = 0, batch = 0;
+		unsigned int seed = 1;
+		int i, round;
+
+		initmem(strategy, 1 << 22);
+		for (i = 0; i < BENCH_SLOTS; i++)
+			background[i] = mymalloc(rand_r(&seed) % 512 + 1);
+		for (i = 0; i < BENCH_SLOTS; i += 2)
+			myfree(background[i]);
+
+		for (round = 0; round < BATCH_ROUNDS; round++)
+		{
+			for (i = 0; i < BATCH_SIZE; i++)
+				sizes[i] = rand_r(&seed) % 256 + 1;
+
+			/* odd rounds use the batch calls; blocks are freed in a shuffled order */
+			unsigned long long start = bench_clock();
+			if (round % 2)
+				mymalloc_batch(sizes, BATCH_SIZE, blocks);
+			else
+				for (i = 0; i < BATCH_SIZE; i++)
+					blocks[i] = mymalloc(sizes[i]);
+
+			for (i = BATCH_SIZE - 1; i > 0; i--)
+			{
+				int j = rand_r(&seed) % (i + 1);
+				void *swap = blocks[i];
+				blocks[i] = blocks[j];
+				blocks[j] = swap;
+			}
+
+			if (round % 2)
+				myfree_batch(blocks, BATCH_SIZE);
+			else
+				for (i = 0; i < BATCH_SIZE; i++)
+					myfree(blocks[i]);
+
+			if (round % 2)
+				batch += bench_clock() - start;
+			else
+				single += bench_clock() - start;
+		}
+
+		fprintf(log, "\t%-7s individual %8.1f  batch %8.1f\n", strategy_name(strategy), (double)single / (BATCH_ROUNDS / 2 * BATCH_SIZE), (double)batch / (BATCH_ROUNDS / 2 * BATCH_SIZE));
+	}
+
+	fclose(log);
+	return 0;
+}
+
+#define HUGE_POOL (1 << 25)
+#define HUGE_BLOCKS 2048
+#define HUGE_TOUCHES (1 << 21)
+
+// Anonymous memory of this process in transparent huge pages, in kB, or -1 if the kernel does not say.
+static long anon_huge_kb()
+{
+	char line[256];
+	long kb = -1;
+	FILE *smaps = fopen("/proc/self/smaps_rollup", "r");
+
+	if (smaps == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), smaps))
+		if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+			break;
+	fclose(smaps);
+	return kb;
+}
+
+/* the same workload on a pool with huge pages refused and asked for: blocks
+ * of up to 16 kB are allocated until the pool is half full, every other one
+ * is freed and allocated again, and then random bytes all over the blocks
+ * are updated, which costs a TLB miss on most touches with normal pages */
+int do_hugepage_benchmark(int argc, char **argv)
+{
+	static char *blocks[HUGE_BLOCKS];
+	static size_t sizes[HUGE_BLOCKS];
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	FILE *log = fopen("tests.log", "a");
+	if (log == NULL)
+	{
+		perror("Can't append to log file.\n");
+		return 1;
+	}
+	fprintf(log, "Huge page benchmark: pool size == %d, %d blocks from 1 to 16384 bytes, %d random touches, " BENCH_UNIT " per operation\n", HUGE_POOL, HUGE_BLOCKS, HUGE_TOUCHES);
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		/* a bitmap this large takes a long scan per allocation; blocks land as with first fit */
+		if (strategy == Bitmap && lbound != ubound)
+			continue;
+
+		for (int huge = -1; huge <= 1; huge += 2)
+		{
+			struct mem_options options = {0};
+			unsigned long long allocs = 0, touches = 0;
+			unsigned int seed = 1;
+			int i, count;
+
+			options.huge_pages = huge;
+			initmem_opts(strategy, HUGE_POOL, &options);
+
+			unsigned long long start = bench_clock();
+			for (count = 0; count < HUGE_BLOCKS; count++)
+			{
+				sizes[count] = rand_r(&seed) % 16384 + 1;
+				if (!(blocks[count] = mymalloc(sizes[count])))
+					break;
+			}
+			for (i = 0; i < count; i += 2)
+				myfree(blocks[i]);
+			for (i = 0; i < count; i += 2)
+				if (!(blocks[i] = mymalloc(sizes[i])))
+					sizes[i] = 0;
+			allocs = bench_clock() - start;
+
+			/* fault everything in first, so that only the TLB is measured */
+			for (i = 0; i < count; i++)
+				if (sizes[i])
+					memset(blocks[i], 0, sizes[i]);
+
+			start = bench_clock();
+			for (i = 0; i < HUGE_TOUCHES; i++)
+			{
+				int slot = rand_r(&seed) % count;
+				if (sizes[slot])
+					blocks[slot][rand_r(&seed) % sizes[slot]]++;
+			}
+			touches = bench_clock() - start;
+
+			fprintf(log, "\t%-7s huge pages %-3s  allocation %8.1f  touch %6.1f  (%ld kB in huge pages)\n", strategy_name(strategy), huge > 0 ? "on" : "off", (double)allocs / (count + count / 2), (double)touches / HUGE_TOUCHES, anon_huge_kb());
+		}
+	}
+
+	fclose(log);
+	return 0;
+}
+
 /* basic sequential allocation of single byte blocks */
 int test_alloc_1(int argc, char **argv)
 {
 	strategies strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 
 	if (strategyFromString(*(argv + 1)) > 0)
 		lbound = ubound = strategyFromString(*(argv + 1));
 
 	for (strategy = lbound; strategy <= ubound; strategy++)
 	{
+		if (skip_if_buddy(strategy))
+			continue;
+
 		int correct_holes = 0;
 		int correct_alloc = 100;
 		int correct_largest_free = 0;
@@ -209,13 +558,16 @@ int test_alloc_2(int argc, char **argv)
 {
 	strategies strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 
 	if (strategyFromString(*(argv + 1)) > 0)
 		lbound = ubound = strategyFromString(*(argv + 1));
 
 	for (strategy = lbound; strategy <= ubound; strategy++)
 	{
+		if (skip_if_buddy(strategy))
+			continue;
+
 		int correct_holes;
 		int correct_alloc;
 		int correct_largest_free;
@@ -239,7 +591,7 @@ int test_alloc_2(int argc, char **argv)
 		}
 
 		correct_alloc = 2;
-		correct_small = (strategy == First || strategy == Best);
+		correct_small = (strategy == First || strategy == Best || strategy == Bitmap || strategy == TLSF);
 
 		switch (strategy)
 		{
@@ -263,6 +615,13 @@ int test_alloc_2(int argc, char **argv)
 			correct_holes = 2;
 			correct_largest_free = 88;
 			break;
+		case Bitmap:
+		case TLSF:
+			correctThird = (third == first);
+			correct_holes = 2;
+			correct_largest_free = 89;
+			break;
+		case Buddy:
 		case NotSet:
 			break;
 		}
@@ -306,13 +665,16 @@ int test_alloc_3(int argc, char **argv)
 {
 	strategies strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 
 	if (strategyFromString(*(argv + 1)) > 0)
 		lbound = ubound = strategyFromString(*(argv + 1));
 
 	for (strategy = lbound; strategy <= ubound; strategy++)
 	{
+		if (skip_if_buddy(strategy))
+			continue;
+
 		int correct_holes = 50;
 		int correct_alloc = 50;
 		int correct_largest_free = 1;
@@ -378,13 +740,16 @@ int test_alloc_4(int argc, char **argv)
 {
 	strategies strategy;
 	int lbound = 1;
-	int ubound = 4;
+	int ubound = 7;
 
 	if (strategyFromString(*(argv + 1)) > 0)
 		lbound = ubound = strategyFromString(*(argv + 1));
 
 	for (strategy = lbound; strategy <= ubound; strategy++)
 	{
+		if (skip_if_buddy(strategy))
+			continue;
+
 		int correct_holes = 0;
 		int correct_alloc = 100;
 		int correct_largest_free = 0;
@@ -410,9 +775,11 @@ int test_alloc_4(int argc, char **argv)
 		for (i = 1; i < 100; i += 2)
 		{
 			void *pointer = mymalloc(1);
-			if (i > 1 && pointer != (lastPointer + 2))
+			/* TLSF takes the most recently freed block of a size class, so it goes backwards */
+			int step = strategy == TLSF ? -2 : 2;
+			if (i > 1 && pointer != (lastPointer + step))
 			{
-				printf("Second allocation with %s was not sequential at %i; expected %p, actual %p\n", strategy_name(strategy), i, lastPointer + 1, pointer);
+				printf("Second allocation with %s was not sequential at %i; expected %p, actual %p\n", strategy_name(strategy), i, lastPointer + step, pointer);
 				return 1;
 			}
 			lastPointer = pointer;
@@ -440,6 +807,1479 @@ int test_alloc_4(int argc, char **argv)
 	return 0;
 }
 
+/* freeing pointers the pool does not own must be reported and leave the pool untouched */
+int test_free_invalid(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		if (skip_if_buddy(strategy))
+			continue;
+
+		int local;
+		void *first;
+		void *second;
+
+		initmem(strategy, 100);
+
+		first = mymalloc(10);
+		second = mymalloc(10);
+
+		myfree(first + 1);	/* interior pointer */
+		myfree(&local);		/* pointer outside the pool */
+		myfree(mem_pool() + 20); /* start of the free tail */
+
+		if (mem_allocated() != 20 || mem_holes() != 1)
+		{
+			printf("Invalid free changed the pool with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		myfree(first);
+		myfree(first); /* double free */
+
+		if (mem_allocated() != 10 || mem_holes() != 2 || !mem_is_alloc(second))
+		{
+			printf("Double free changed the pool with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* small-hole counts at several thresholds, including the last block, and the hole histogram */
+int test_small_free(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		if (skip_if_buddy(strategy))
+			continue;
+
+		int thresholds[] = {0, 1, 3, 4, 89, 90};
+		int correct_small[] = {0, 1, 2, 3, 3, 4};
+		int correct_histogram[8] = {1, 1, 1, 0, 0, 0, 1, 0};
+		int histogram[8];
+		void *a, *c, *e;
+		int i;
+
+		initmem(strategy, 100);
+
+		/* holes of 1, 2 and 4 bytes, followed by a 90 byte tail */
+		a = mymalloc(1);
+		mymalloc(1);
+		c = mymalloc(2);
+		mymalloc(1);
+		e = mymalloc(4);
+		mymalloc(1);
+		myfree(a);
+		myfree(c);
+		myfree(e);
+
+		for (i = 0; i < sizeof(thresholds) / sizeof(int); i++)
+		{
+			if (mem_small_free(thresholds[i]) != correct_small[i])
+			{
+				printf("Small holes up to %d bytes counted as %d, should be %d with %s\n", thresholds[i], mem_small_free(thresholds[i]), correct_small[i], strategy_name(strategy));
+				return 1;
+			}
+		}
+
+		if (mem_hole_histogram(histogram, 8) != 4 || memcmp(histogram, correct_histogram, sizeof(histogram)))
+		{
+			printf("Hole histogram is wrong with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* ownership queries over ranges spanning one or more blocks */
+int test_alloc_range(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		if (skip_if_buddy(strategy))
+			continue;
+
+		void *a, *b, *c;
+
+		initmem(strategy, 100);
+
+		a = mymalloc(10);
+		b = mymalloc(10);
+		c = mymalloc(10);
+
+		if (mem_is_alloc_range(a, 30) != MEM_RANGE_ALLOC || mem_is_alloc_range(a + 5, 10) != MEM_RANGE_ALLOC)
+		{
+			printf("Allocated range over several blocks not reported as allocated with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		myfree(b);
+
+		if (mem_is_alloc_range(a, 10) != MEM_RANGE_ALLOC ||
+			mem_is_alloc_range(b + 2, 3) != MEM_RANGE_FREE ||
+			mem_is_alloc_range(a + 5, 10) != MEM_RANGE_MIXED ||
+			mem_is_alloc_range(a, 30) != MEM_RANGE_MIXED ||
+			mem_is_alloc_range(c + 5, 10) != MEM_RANGE_MIXED ||
+			mem_is_alloc_range(c + 10, 70) != MEM_RANGE_FREE)
+		{
+			printf("Range ownership reported wrongly with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		if (mem_is_alloc_range(c + 10, 71) != MEM_RANGE_INVALID || mem_is_alloc_range(a, 0) != MEM_RANGE_INVALID)
+		{
+			printf("Range outside the pool not rejected with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* myrealloc: shrinking and growing in place, moving when the next block is taken, in both layouts */
+int test_realloc(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	layouts layout;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		if (skip_if_buddy(strategy))
+			continue;
+
+		for (layout = ListLayout; layout <= TagLayout; layout++)
+		{
+			struct mem_options options = {layout};
+			char *a, *b, *moved;
+			int i;
+
+			initmem_opts(strategy, 1000, &options);
+
+			a = mymalloc(10);
+			b = mymalloc(10);
+			for (i = 0; i < 10; i++)
+				a[i] = i;
+
+			/* b is followed by the free tail, so it shrinks and grows where it is */
+			if (myrealloc(b, 5) != b || myrealloc(b, 50) != b || mem_is_alloc_range(b, 50) != MEM_RANGE_ALLOC || mem_holes() != 1)
+			{
+				printf("Block not resized in place with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			/* a is followed by b, so it has to move */
+			moved = myrealloc(a, 100);
+			if (!moved || moved == a || mem_is_alloc(a) || !mem_is_alloc(moved + 99))
+			{
+				printf("Block not moved by realloc with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+			for (i = 0; i < 10; i++)
+			{
+				if (moved[i] != i)
+				{
+					printf("Realloc lost the contents with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+					return 1;
+				}
+			}
+
+			/* the list layout accounts for every byte */
+			if (layout == ListLayout && (mem_allocated() != 150 || myrealloc(b, 10) != b || mem_allocated() != 110))
+			{
+				printf("Realloc changed the allocated bytes wrongly with %s\n", strategy_name(strategy));
+				return 1;
+			}
+
+			if (myrealloc(moved, 2000) || !mem_is_alloc(moved) || myrealloc(moved + 1, 5) || myrealloc(moved, 0) || mem_is_alloc(moved))
+			{
+				printf("Failed or invalid realloc handled wrongly with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* mymemalign and the pool-wide minimum alignment */
+int test_align(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	layouts layout;
+	int sizes[] = {1, 7, 33, 100};
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		for (layout = ListLayout; layout <= TagLayout; layout++)
+		{
+			struct mem_options options = {layout, 0, 0, 16};
+			char *small, *aligned;
+			int i;
+
+			if (skip_if_unsupported(strategy, layout))
+				continue;
+
+			initmem_opts(strategy, 4096, &options);
+			for (i = 0; i < 4; i++)
+			{
+				char *block = mymalloc(sizes[i]);
+				if (!block || (size_t)block % 16)
+				{
+					printf("Block of %d bytes at %p not 16-byte aligned with %s, %s layout\n", sizes[i], block, strategy_name(strategy), layout_name(layout));
+					return 1;
+				}
+			}
+
+			/* 1, 7, 33 and 100 bytes take 16, 16, 48 and 112 */
+			if (layout == ListLayout && strategy != Buddy && (mem_allocated() != 192 || mem_internal_fragmentation() != 51))
+			{
+				printf("Alignment rounding reported as %d bytes in %d allocated with %s, should be 51 in 192\n", mem_internal_fragmentation(), mem_allocated(), strategy_name(strategy));
+				return 1;
+			}
+
+			options.alignment = 0;
+			initmem_opts(strategy, 4096, &options);
+
+			small = mymalloc(3);
+			aligned = mymemalign(64, 10);
+			if (!aligned || (size_t)aligned % 64 || mem_is_alloc_range(aligned, 10) != MEM_RANGE_ALLOC || mymemalign(48, 10))
+			{
+				printf("mymemalign(64, 10) gave %p with %s, %s layout\n", aligned, strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			/* the padding between the two blocks is a hole, not part of either */
+			if (layout == ListLayout && strategy != Buddy && (mem_allocated() != 13 || mem_holes() != 2 || mem_is_alloc(small + 3) || mem_is_alloc(aligned - 1)))
+			{
+				printf("Alignment padding not returned to the free list with %s\n", strategy_name(strategy));
+				return 1;
+			}
+
+			myfree(aligned);
+			myfree(small);
+			if (mem_holes() != 1 || mem_allocated() != 0)
+			{
+				printf("Aligned block not freed with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* mycalloc clears reused blocks and trusts untouched pool memory to be zero */
+int test_calloc(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	layouts layout;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		for (layout = ListLayout; layout <= TagLayout; layout++)
+		{
+			struct mem_options options = {layout};
+			char *block;
+			int i;
+
+			if (skip_if_unsupported(strategy, layout))
+				continue;
+
+			initmem_opts(strategy, 1000, &options);
+
+			for (i = 0; i < 3; i++)
+			{
+				int j = 0;
+
+				block = mycalloc(25, 4);
+				while (block && j < 100 && block[j] == 0)
+					j++;
+				if (j < 100)
+				{
+					printf("mycalloc gave a dirty block with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+					return 1;
+				}
+				memset(block, 1, 100);
+				myfree(block);
+			}
+
+			if (mycalloc(0, 4) || mycalloc(4, 0) || mycalloc((size_t)-1 / 2, 3))
+			{
+				printf("Empty or overflowing mycalloc not refused with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			/* fresh pool memory is not cleared again: a byte written behind the allocator's back survives */
+			if (layout == ListLayout)
+			{
+				initmem_opts(strategy, 1000, &options);
+				memset(mem_pool(), 1, 1000);
+				block = mycalloc(1, 10);
+				if (!block || block[0] != 1)
+				{
+					printf("mycalloc cleared fresh memory with %s\n", strategy_name(strategy));
+					return 1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* handles and compaction: movable blocks slide down, pinned ones stay put */
+int test_compact(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		mem_handle handles[10];
+		char *pinned;
+		int i, steps;
+
+		/* buddy blocks never move, see mem_compact */
+		if (strategy == Buddy)
+			continue;
+
+		for (int incremental = 0; incremental <= 1; incremental++)
+		{
+			initmem(strategy, 1100);
+			for (i = 0; i < 10; i++)
+			{
+				handles[i] = mymalloc_handle(100);
+				memset(mem_deref(handles[i]), i, 100);
+			}
+			for (i = 0; i < 10; i += 2)
+				myfree_handle(handles[i]);
+
+			if (mem_holes() != 6 || mem_deref(handles[0]) || mem_deref(handles[1]) != (char *)mem_pool() + 100)
+			{
+				printf("Handles not set up as expected with %s\n", strategy_name(strategy));
+				return 1;
+			}
+
+			/* every step moves one block; the last one finds nothing left to move */
+			if (incremental)
+			{
+				for (steps = 1; !mem_compact_step(0); steps++)
+					;
+				if (steps != 6)
+				{
+					printf("Incremental compaction took %d steps with %s, should be 6\n", steps, strategy_name(strategy));
+					return 1;
+				}
+			}
+
+			/* no hole is large enough, so mymalloc compacts the pool first */
+			if (!mymalloc(500) || mem_holes() != 1 || mem_free() != 100)
+			{
+				printf("Allocation did not compact the pool with %s\n", strategy_name(strategy));
+				return 1;
+			}
+			for (i = 1; i < 10; i += 2)
+			{
+				char *block = mem_deref(handles[i]);
+				if (block != (char *)mem_pool() + i / 2 * 100 || block[0] != i || block[99] != i)
+				{
+					printf("Handle %d moved wrongly by compaction with %s\n", i, strategy_name(strategy));
+					return 1;
+				}
+			}
+		}
+
+		/* a block without a handle is a barrier */
+		initmem(strategy, 1100);
+		handles[0] = mymalloc_handle(100);
+		pinned = mymalloc(100);
+		handles[1] = mymalloc_handle(100);
+		handles[2] = mymalloc_handle(100);
+		myfree_handle(handles[0]);
+		myfree_handle(handles[1]);
+		mem_compact();
+		if (mem_holes() != 2 || pinned != (char *)mem_pool() + 100 || mem_deref(handles[2]) != (char *)mem_pool() + 200 || !mem_is_alloc(pinned))
+		{
+			printf("Compaction moved past a pinned block with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* mymalloc_batch carves neighbouring blocks, myfree_batch frees in any order */
+int test_batch(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	layouts layout;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		for (layout = ListLayout; layout <= TagLayout; layout++)
+		{
+			struct mem_options options = {layout};
+			size_t sizes[] = {10, 20, 30, 40};
+			size_t large[] = {600, 600};
+			void *blocks[5];
+			void *shuffled[6];
+			int i, holes;
+
+			if (skip_if_unsupported(strategy, layout))
+				continue;
+
+			initmem_opts(strategy, 1000, &options);
+			holes = mem_holes(); /* buddy starts with one block per power of two in 1000 */
+
+			if (mymalloc_batch(sizes, 4, blocks) != 4)
+			{
+				printf("Batch of 4 not allocated with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+			for (i = 0; i < 4; i++)
+			{
+				if (mem_is_alloc_range(blocks[i], sizes[i]) != MEM_RANGE_ALLOC)
+				{
+					printf("Batch block %d not allocated with %s, %s layout\n", i, strategy_name(strategy), layout_name(layout));
+					return 1;
+				}
+			}
+
+			/* one carve puts the blocks side by side */
+			if (layout == ListLayout && strategy != Buddy && (blocks[3] != (char *)blocks[0] + 60 || mem_allocated() != 100 || mem_holes() != 1))
+			{
+				printf("Batch not carved from one block with %s\n", strategy_name(strategy));
+				return 1;
+			}
+
+			/* any order, with a NULL and a pointer that was never allocated */
+			shuffled[0] = blocks[2];
+			shuffled[1] = blocks[0];
+			shuffled[2] = NULL;
+			shuffled[3] = blocks[3];
+			shuffled[4] = (char *)blocks[3] + 1;
+			shuffled[5] = blocks[1];
+			myfree_batch(shuffled, 6);
+			if (mem_holes() != holes || mem_allocated() != 0)
+			{
+				printf("Batch not freed with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			/* the two do not fit together, so they are served one by one */
+			if (mymalloc_batch(large, 2, blocks) != (strategy == Buddy ? 0 : 1) || blocks[1])
+			{
+				printf("Batch larger than the pool handled wrongly with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+			myfree_batch(blocks, 2);
+			if (mem_holes() != holes)
+			{
+				printf("Partial batch not freed with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* myfree_sized frees like myfree and, in builds with assertions, checks the hint */
+int test_free_sized(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	layouts layout;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		for (layout = ListLayout; layout <= TagLayout; layout++)
+		{
+			struct mem_options options = {layout};
+			void *first, *second;
+			int holes;
+
+			if (skip_if_unsupported(strategy, layout))
+				continue;
+
+			initmem_opts(strategy, 1000, &options);
+			holes = mem_holes();
+			first = mymalloc(10);
+			second = mymalloc(20);
+
+#ifndef NDEBUG
+			myfree_sized(first, 500);
+			if (!mem_is_alloc(first))
+			{
+				printf("myfree_sized freed a block despite a wrong size with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+#endif
+
+			/* NULL and pointers that do not start a block are ignored */
+			myfree_sized(NULL, 0);
+			myfree_sized(&holes, sizeof(holes));
+			myfree_sized((char *)second + 1, 19);
+			if (!mem_is_alloc(second) || mem_holes() != holes)
+			{
+				printf("myfree_sized freed something that is not a block with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			myfree_sized(first, 10);
+			myfree_sized(second, 20);
+			if (mem_is_alloc(first) || mem_is_alloc(second) || mem_holes() != holes || mem_allocated() != 0)
+			{
+				printf("myfree_sized did not free with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+		}
+
+#ifndef NDEBUG
+		/* blocks held by a thread cache are checked in the cache's own lookup */
+		{
+			struct mem_options options = {ListLayout, 1};
+			void *block;
+
+			initmem_opts(strategy, 1000, &options);
+			block = mymalloc(10);
+			myfree_sized(block, 500);
+			mem_flush_thread_cache();
+			if (!mem_is_alloc(block))
+			{
+				printf("myfree_sized freed a cached block despite a wrong size with %s\n", strategy_name(strategy));
+				return 1;
+			}
+			myfree_sized(block, 10);
+			mem_flush_thread_cache();
+			if (mem_is_alloc(block))
+			{
+				printf("myfree_sized did not free a cached block with %s\n", strategy_name(strategy));
+				return 1;
+			}
+		}
+#endif
+	}
+
+	return 0;
+}
+
+/* lazy coalescing: freed blocks wait unmerged until a miss or the limit */
+int test_lazy(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	struct mem_options options = {ListLayout, 0, 0, 0, 8};
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		void *blocks[10];
+		int i;
+
+		/* buddy and bitmap always merge at once */
+		if (strategy == Buddy || strategy == Bitmap)
+			continue;
+
+		initmem_opts(strategy, 1000, &options);
+		for (i = 0; i < 3; i++)
+			blocks[i] = mymalloc(100);
+		myfree(blocks[0]);
+		myfree(blocks[1]);
+
+		if (mem_holes() != 3 || mem_free() != 900 || mem_is_alloc_range(blocks[0], 200) != MEM_RANGE_FREE)
+		{
+			printf("Freed blocks merged at once with lazy coalescing and %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* the block freed last is taken again for the same size */
+		if (mymalloc(100) != blocks[1])
+		{
+			printf("Quick list not used for an exact size with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* a miss merges everything and tries again */
+		myfree(blocks[1]);
+		myfree(blocks[2]);
+		if (mem_holes() != 4 || mymalloc(800) != mem_pool() || mem_holes() != 1)
+		{
+			printf("Missed allocation did not merge waiting blocks with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* the eighth waiting block sets off a merge */
+		initmem_opts(strategy, 1000, &options);
+		for (i = 0; i < 10; i++)
+			blocks[i] = mymalloc(50);
+		for (i = 0; i < 10; i++)
+			myfree(blocks[i]);
+		if (mem_holes() != 4 || mem_largest_free() != 500)
+		{
+			printf("Waiting blocks not merged at the limit with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* growable pools: full pools map more segments, up to the limit */
+int test_grow(int argc, char **argv)
+{
+	strategies strategy;
+	layouts layout;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		for (layout = ListLayout; layout <= TagLayout; layout++)
+		{
+			struct mem_options options = {layout, 0, 0, 0, 0, 1, 4000};
+			char *blocks[50];
+			int count, i;
+
+			if (skip_if_unsupported(strategy, layout))
+				continue;
+
+			initmem_opts(strategy, 1000, &options);
+			for (count = 0; count < 50 && (blocks[count] = mymalloc(100)); count++)
+				memset(blocks[count], count, 100);
+
+			if (count < 20 || mem_total() != 4000)
+			{
+				printf("Pool did not grow to its limit with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			for (i = 0; i < count; i++)
+			{
+				if (blocks[i][0] != (char)i || blocks[i][99] != (char)i || !mem_is_alloc(blocks[i]))
+				{
+					printf("Block in a new segment lost with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+					return 1;
+				}
+			}
+
+			/* freeing everything leaves one hole per segment at most */
+			for (i = 0; i < count; i++)
+				myfree(blocks[i]);
+			if (mem_allocated() != 0 || mem_largest_free() > 3000)
+			{
+				printf("Blocks merged across segments with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			/* without a limit a segment is made large enough for the request */
+			options.max_size = 0;
+			initmem_opts(strategy, 1000, &options);
+			if (!mymalloc(5000) || mem_total() < 11000)
+			{
+				printf("Pool did not grow for a large block with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+		}
+	}
+
+	/* the int statistics cap growth at INT_MAX; the segments are mapped but never touched */
+	for (layout = ListLayout; layout <= TagLayout; layout++)
+	{
+		struct mem_options options = {layout, 0, 0, 0, 0, 1};
+
+		initmem_opts(First, 1 << 20, &options);
+		while (mymalloc(1 << 28))
+			;
+		if (mem_total() < 1 << 30 || mem_free() < 0 || mem_largest_free() < 0 || mem_allocated() < 0)
+		{
+			printf("Pool grew past what its statistics count with %s layout\n", layout_name(layout));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* trimming: free pages go back to the OS and come back zero filled */
+int test_trim(int argc, char **argv)
+{
+	strategies strategy;
+	layouts layout;
+	int lbound = 1;
+	int ubound = 7;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		for (layout = ListLayout; layout <= TagLayout; layout++)
+		{
+			struct mem_options options = {layout};
+			char *block;
+			int i;
+
+			if (skip_if_unsupported(strategy, layout))
+				continue;
+
+			/* the boundary tags at either end of the pool are all it touches */
+			initmem_opts(strategy, 1 << 20, &options);
+			if (mem_resident() > 2 * 4096)
+			{
+				printf("Untouched pool is resident with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			block = mymalloc(1 << 18);
+			memset(block, 1, 1 << 18);
+			myfree(block);
+			if (mem_resident() < 1 << 18 || mem_trim() < (1 << 18) - 2 * 4096 || mem_resident() > 2 * 4096)
+			{
+				printf("Free pages not given back by mem_trim with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+				return 1;
+			}
+
+			block = mycalloc(1, 1 << 18);
+			for (i = 0; i < 1 << 18; i += 1000)
+			{
+				if (block[i] != 0)
+				{
+					printf("Trimmed memory not zero with %s, %s layout\n", strategy_name(strategy), layout_name(layout));
+					return 1;
+				}
+			}
+			myfree(block);
+
+			/* past the threshold, freeing a block is enough */
+			if (layout == ListLayout)
+			{
+				options.trim_threshold = 1 << 16;
+				initmem_opts(strategy, 1 << 20, &options);
+				block = mymalloc(1 << 17);
+				memset(block, 1, 1 << 17);
+				myfree(block);
+				if (mem_resident() > 2 * 4096 || mem_trim() != 0)
+				{
+					printf("Freed block not trimmed at the threshold with %s\n", strategy_name(strategy));
+					return 1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* file-backed pools: a snapshot written by mem_sync is what a restart sees */
+int test_file(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	char path[64];
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	snprintf(path, sizeof(path), "/tmp/mymem-test-%d.pool", (int)getpid());
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		char *text, *root;
+		int allocated;
+
+		unlink(path);
+		if (strategy == Buddy)
+		{
+			if (initmem_file(path, strategy, 1 << 16) != -1)
+			{
+				printf("File-backed pool opened with buddy\n");
+				return 1;
+			}
+			continue;
+		}
+
+		if (initmem_file(path, strategy, 1 << 16) != 0 || access(path, F_OK))
+		{
+			printf("New file-backed pool not created with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* the root block holds the offset of the text */
+		text = mymalloc(100);
+		root = mymalloc(sizeof(size_t));
+		strcpy(text, "snapshot");
+		*(size_t *)root = text - (char *)mem_pool();
+		mem_set_root(root);
+		allocated = mem_allocated();
+		if (mem_sync())
+		{
+			printf("mem_sync failed with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* changes after the last mem_sync are lost */
+		strcpy(text, "changed");
+		mymalloc(300);
+
+		if (initmem_file(path, strategy, 0) != 1 || mem_total() != 1 << 16 || !(root = mem_root()))
+		{
+			printf("Snapshot not reopened with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		text = (char *)mem_pool() + *(size_t *)root;
+		if (strcmp(text, "snapshot") || mem_allocated() != allocated || !mem_is_alloc(text))
+		{
+			printf("Reopened pool differs from the snapshot with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		char *more = mymalloc(100);
+		if (!more || more == text || more == root)
+		{
+			printf("Reopened pool cannot allocate with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* a snapshot of another size is not replaced */
+		if (initmem_file(path, strategy, 1 << 17) != -1 || initmem_file(path, strategy, 0) != 1 || !mem_root())
+		{
+			printf("Snapshot replaced by a pool of another size with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	/* nor is a file that holds no snapshot, and the pool from before is kept */
+	FILE *notes = fopen(path, "w");
+	fputs("notes\n", notes);
+	fclose(notes);
+	initmem(First, 1000);
+	char *kept = mymalloc(100);
+	if (initmem_file(path, First, 4096) != -1 || (notes = fopen(path, "r")) == NULL)
+	{
+		printf("File without a snapshot opened as a pool\n");
+		return 1;
+	}
+	if (!mem_is_alloc(kept) || mem_total() != 1000 || !mymalloc(100))
+	{
+		printf("Pool lost when a file could not be opened\n");
+		return 1;
+	}
+	char line[16] = "";
+	fgets(line, sizeof(line), notes);
+	fclose(notes);
+	if (strcmp(line, "notes\n"))
+	{
+		printf("File without a snapshot overwritten\n");
+		return 1;
+	}
+
+	unlink(path);
+	return 0;
+}
+
+#define SHARED_CHILDREN 4
+
+/* a random mix of allocations and frees in a shared pool, ending with one
+ * block that is handed to the parent by its offset */
+static int shared_child(int child, int out)
+{
+	char *blocks[64] = {0};
+	size_t sizes[64];
+	unsigned int seed = child + 1;
+	int i, slot;
+
+	for (i = 0; i < 5000; i++)
+	{
+		slot = rand_r(&seed) % 64;
+		if (blocks[slot])
+		{
+			if (blocks[slot][0] != (char)(slot + child) || blocks[slot][sizes[slot] - 1] != (char)(slot + child))
+				return 1;
+			myfree(blocks[slot]);
+			blocks[slot] = NULL;
+		}
+		else if ((blocks[slot] = mymalloc(sizes[slot] = rand_r(&seed) % 1000 + 1)))
+		{
+			memset(blocks[slot], slot + child, sizes[slot]);
+		}
+	}
+	for (slot = 0; slot < 64; slot++)
+		if (blocks[slot])
+			myfree(blocks[slot]);
+
+	char *gift = mymalloc(1000);
+	if (!gift)
+		return 1;
+	memset(gift, child, 1000);
+
+	size_t offset = gift - (char *)mem_pool();
+	return write(out, &offset, sizeof(offset)) != sizeof(offset);
+}
+
+/* shared pools: forked and attaching processes allocate and free in one pool */
+int test_shared(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	char name[64];
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	snprintf(name, sizeof(name), "/mymem-test-%d", (int)getpid());
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		int pipes[2], status, child;
+		size_t offset;
+		char *block;
+
+		shm_unlink(name);
+		if (strategy == Buddy)
+		{
+			if (initmem_shared(name, strategy, 1 << 20) != -1)
+			{
+				printf("Shared pool opened with buddy\n");
+				return 1;
+			}
+			continue;
+		}
+
+		if (initmem_shared(name, strategy, 1 << 20) != 0 || pipe(pipes))
+		{
+			printf("Shared pool not created with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		for (child = 0; child < SHARED_CHILDREN; child++)
+			if (fork() == 0)
+				_exit(shared_child(child, pipes[1]));
+
+		/* every child leaves one block behind, which the parent frees */
+		for (child = 0; child < SHARED_CHILDREN; child++)
+		{
+			if (read(pipes[0], &offset, sizeof(offset)) != sizeof(offset))
+				break;
+			block = (char *)mem_pool() + offset;
+			if (!mem_is_alloc(block) || block[0] != block[999] || block[0] < 0 || block[0] >= SHARED_CHILDREN)
+				break;
+			myfree(block);
+		}
+		while (wait(&status) > 0)
+			if (!WIFEXITED(status) || WEXITSTATUS(status))
+				child = -1;
+		if (child != SHARED_CHILDREN)
+		{
+			printf("Blocks lost between processes with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* a process that attaches by name may map the pool elsewhere */
+		if (fork() == 0)
+		{
+			if (initmem_shared(name, strategy, 0) != 1 || !(block = mymalloc(100)))
+				_exit(1);
+			offset = block - (char *)mem_pool();
+			_exit(write(pipes[1], &offset, sizeof(offset)) != sizeof(offset));
+		}
+		wait(&status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) || read(pipes[0], &offset, sizeof(offset)) != sizeof(offset) || !mem_is_alloc((char *)mem_pool() + offset))
+		{
+			printf("Attached process did not share the pool with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		myfree((char *)mem_pool() + offset);
+
+		if (mem_allocated() != 0 || mem_holes() != 1)
+		{
+			printf("Shared pool not empty after all frees with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		close(pipes[0]);
+		close(pipes[1]);
+
+		/* processes killed in the middle of allocating, most likely holding the lock */
+		for (child = 0; child < SHARED_CHILDREN; child++)
+		{
+			pid_t pid = fork();
+			if (pid == 0)
+			{
+				unsigned int seed = child + 1;
+				for (;;)
+					myfree(mymalloc(rand_r(&seed) % 1000 + 1));
+			}
+			usleep(2000);
+			kill(pid, SIGKILL);
+			waitpid(pid, &status, 0);
+		}
+		if (!(block = mymalloc(100)) || !mem_is_alloc(block))
+		{
+			printf("Shared pool unusable after a process died with %s\n", strategy_name(strategy));
+			return 1;
+		}
+		myfree(block);
+	}
+	shm_unlink(name);
+
+	/* attaching gives up on a creator that died before sizing the object, or
+	 * before setting up the pool, and keeps the pool from before */
+	initmem(First, 1000);
+	char *kept = mymalloc(100);
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0 || initmem_shared(name, First, 0) != -1 || ftruncate(fd, 1 << 16) || initmem_shared(name, First, 0) != -1)
+	{
+		printf("Attached to a shared pool that was never set up\n");
+		return 1;
+	}
+	close(fd);
+	if (!mem_is_alloc(kept) || mem_total() != 1000 || !mymalloc(100))
+	{
+		printf("Pool lost when a shared pool could not be attached\n");
+		return 1;
+	}
+
+	shm_unlink(name);
+	return 0;
+}
+
+/* the boundary-tag layout: placement, coalescing and the status functions */
+int test_tags(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	struct mem_options options = {TagLayout};
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		if (skip_if_buddy(strategy))
+			continue;
+
+		void *first;
+		void *second;
+		void *third;
+		int correctThird;
+		int empty_free;
+
+		initmem_opts(strategy, 1000, &options);
+		empty_free = mem_free();
+
+		if (mem_holes() != 1 || mem_allocated() != 0 || mem_free() + mem_overhead() != mem_total())
+		{
+			printf("Empty tag pool reported wrongly with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		/* alloc, alloc, free, alloc: the same placement rules as alloc2 */
+		first = mymalloc(10);
+		second = mymalloc(1);
+		myfree(first);
+		third = mymalloc(1);
+
+		if (strategy == First || strategy == Best || strategy == Bitmap || strategy == TLSF)
+			correctThird = (third == first);
+		else
+			correctThird = (third > second);
+
+		if (!correctThird || !mem_is_alloc(third) || mem_is_alloc_range(second, 1) != MEM_RANGE_ALLOC)
+		{
+			printf("Third allocation placed wrongly in tag layout with %s\n", strategy_name(strategy));
+			return 1;
+		}
+
+		myfree(second + 1);	 /* not a block */
+		myfree(first);		 /* free (first/best) or double free (worst/next) */
+		myfree(second);
+		myfree(third);
+
+		if (mem_holes() != 1 || mem_allocated() != 0 || mem_free() != empty_free || mem_largest_free() != empty_free)
+		{
+			printf("Tag layout did not coalesce back to one hole with %s\n", strategy_name(strategy));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* buddy: power-of-two chunks, splitting, merging only with the buddy, and the rounding waste */
+int test_buddy(int argc, char **argv)
+{
+	void *a, *b, *c;
+	void *blocks[64];
+	unsigned int seed = 3;
+	int i;
+
+	/* 100 bytes are carved into chunks of 64, 32 and 4 */
+	initmem(Buddy, 100);
+	if (mem_holes() != 3 || mem_largest_free() != 64 || mem_free() != 100)
+	{
+		printf("Buddy pool not carved into power-of-two chunks\n");
+		return 1;
+	}
+
+	a = mymalloc(10); /* 16 bytes out of the 32 byte chunk, the smallest that fits */
+	b = mymalloc(3);  /* the 4 byte chunk */
+	c = mymalloc(16); /* a's buddy */
+
+	if (a != mem_pool() + 64 || b != mem_pool() + 96 || c != mem_pool() + 80)
+	{
+		printf("Buddy blocks placed wrongly\n");
+		return 1;
+	}
+
+	if (mem_allocated() != 36 || mem_internal_fragmentation() != 7 || mem_holes() != 1)
+	{
+		printf("Buddy rounding reported as %d bytes in %d allocated, should be 7 in 36\n", mem_internal_fragmentation(), mem_allocated());
+		return 1;
+	}
+
+	if (mymalloc(65) || mymalloc((size_t)-1))
+	{
+		printf("Buddy allocated more than its largest chunk\n");
+		return 1;
+	}
+
+	myfree(a);
+	if (mem_holes() != 2 || mem_largest_free() != 64)
+	{
+		printf("Buddy block merged with an allocated buddy\n");
+		return 1;
+	}
+
+	myfree(c);
+	myfree(b);
+	if (mem_holes() != 3 || mem_allocated() != 0 || mem_internal_fragmentation() != 0 || mem_is_alloc_range(mem_pool(), 100) != MEM_RANGE_FREE)
+	{
+		printf("Buddy pool did not merge back into its chunks\n");
+		return 1;
+	}
+
+	/* two blocks only: the lower half has its buddy as both neighbours */
+	initmem(Buddy, 64);
+	myfree(mymalloc(32));
+	if (mem_holes() != 1 || mymalloc(64) != mem_pool())
+	{
+		printf("Buddy halves did not merge back\n");
+		return 1;
+	}
+
+	/* random churn: every block is aligned to its own size, and everything merges back */
+	initmem(Buddy, 1 << 16);
+	memset(blocks, 0, sizeof(blocks));
+	for (i = 0; i < 5000; i++)
+	{
+		int slot = rand_r(&seed) % 64;
+		if (blocks[slot])
+		{
+			myfree(blocks[slot]);
+			blocks[slot] = NULL;
+		}
+		else
+		{
+			int size = rand_r(&seed) % 1000 + 1;
+			int rounded = 1;
+			while (rounded < size)
+				rounded <<= 1;
+
+			blocks[slot] = mymalloc(size);
+			if (blocks[slot] && (blocks[slot] - mem_pool()) % rounded)
+			{
+				printf("Buddy block of %d bytes not aligned to %d\n", size, rounded);
+				return 1;
+			}
+		}
+	}
+	for (i = 0; i < 64; i++)
+		if (blocks[i])
+			myfree(blocks[i]);
+
+	if (mem_holes() != 1 || mem_largest_free() != 1 << 16)
+	{
+		printf("Buddy pool did not merge back into one block\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* TLSF: requests are rounded up to the next size class, so a block that fits exactly can be passed over */
+int test_tlsf(int argc, char **argv)
+{
+	void *a, *c;
+
+	initmem(TLSF, 1000);
+
+	a = mymalloc(9);
+	mymalloc(1);
+	c = mymalloc(12);
+	mymalloc(1);
+	myfree(a); /* 9 byte hole, class [8, 10) */
+	myfree(c); /* 12 byte hole, class [12, 14) */
+
+	/* 9 bytes search from class [10, 12) up, which skips a's hole */
+	if (mymalloc(9) != c || mymalloc(8) != a)
+	{
+		printf("TLSF did not place blocks by rounded size class\n");
+		return 1;
+	}
+
+	/* holes of 1, 3 and 977 bytes are left */
+	if (mem_holes() != 3 || mem_small_free(3) != 2 || mem_largest_free() != 977 || mem_allocated() != 19)
+	{
+		printf("TLSF status reported wrongly\n");
+		return 1;
+	}
+
+	/* the 977 byte tail is in class [896, 1024): it serves 896 bytes, but not 977,
+	   since only classes that start above a request are searched */
+	if (mymalloc(977) || !mymalloc(896) || mem_free() != 85)
+	{
+		printf("TLSF served the tail wrongly\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+#define BITMAP_OPS 4000
+#define BITMAP_SLOTS 100
+
+/* one deterministic run of allocs and frees; records where every allocation landed */
+static void bitmap_run(strategies strategy, long *offsets)
+{
+	void *blocks[BITMAP_SLOTS] = {0};
+	unsigned int seed = 7;
+	int i;
+
+	initmem(strategy, 20000);
+	for (i = 0; i < BITMAP_OPS; i++)
+	{
+		int slot = rand_r(&seed) % BITMAP_SLOTS;
+		offsets[i] = -1;
+		if (blocks[slot])
+		{
+			myfree(blocks[slot]);
+			blocks[slot] = NULL;
+		}
+		else
+		{
+			/* mostly small blocks, with the odd large one so runs span many words */
+			int size = rand_r(&seed) % 8 ? rand_r(&seed) % 100 + 1 : rand_r(&seed) % 2000 + 1;
+			blocks[slot] = mymalloc(size);
+			if (blocks[slot])
+				offsets[i] = blocks[slot] - mem_pool();
+		}
+	}
+}
+
+/* the bitmap strategy places blocks exactly like first fit, whichever scan kernel it uses */
+int test_bitmap(int argc, char **argv)
+{
+	static long expected[BITMAP_OPS];
+	static long actual[BITMAP_OPS];
+	char *kernels[] = {"scalar", "sse2", "avx2"};
+	int k;
+
+	bitmap_run(First, expected);
+
+	for (k = 0; k < sizeof(kernels) / sizeof(char *); k++)
+	{
+		if (!bitmap_use_kernel(kernels[k]))
+			continue; /* not supported on this CPU */
+
+		bitmap_run(Bitmap, actual);
+		if (memcmp(expected, actual, sizeof(expected)))
+		{
+			printf("Bitmap placement with the %s kernel differs from first fit\n", kernels[k]);
+			return 1;
+		}
+	}
+
+	bitmap_use_kernel(NULL);
+	return 0;
+}
+
+#define THREADS 8
+#define THREAD_BLOCKS 64
+
+/* shared state of the threaded test: every thread hands its live blocks to the next one */
+static void *threadBlocks[THREADS][THREAD_BLOCKS];
+static pthread_barrier_t threadBarrier;
+static int threadErrors;
+
+/* fill a block with a byte that identifies its owner, so overlapping blocks get noticed */
+static int check_block(unsigned char *block, int size, unsigned char mark)
+{
+	int i;
+	for (i = 0; i < size; i++)
+		if (block[i] != mark)
+			return 0;
+	return 1;
+}
+
+static void *thread_worker(void *arg)
+{
+	int id = (int)(long)arg;
+	int sizes[THREAD_BLOCKS] = {0};
+	unsigned int seed = id + 1;
+	int i;
+
+	for (i = 0; i < 20000; i++)
+	{
+		int slot = rand_r(&seed) % THREAD_BLOCKS;
+		if (threadBlocks[id][slot])
+		{
+			if (!check_block(threadBlocks[id][slot], sizes[slot], id))
+				__sync_fetch_and_add(&threadErrors, 1);
+			myfree(threadBlocks[id][slot]);
+			threadBlocks[id][slot] = NULL;
+		}
+		else
+		{
+			sizes[slot] = rand_r(&seed) % 256 + 1;
+			threadBlocks[id][slot] = mymalloc(sizes[slot]);
+			if (threadBlocks[id][slot])
+				memset(threadBlocks[id][slot], id, sizes[slot]);
+		}
+	}
+
+	/* free the blocks the previous thread still holds, then keep allocating */
+	pthread_barrier_wait(&threadBarrier);
+	for (i = 0; i < THREAD_BLOCKS; i++)
+	{
+		void **block = &threadBlocks[(id + THREADS - 1) % THREADS][i];
+		if (*block)
+			myfree(*block);
+		*block = NULL;
+	}
+	pthread_barrier_wait(&threadBarrier);
+	for (i = 0; i < 1000; i++)
+		myfree(mymalloc(rand_r(&seed) % 256 + 1));
+
+	return NULL;
+}
+
+/* many threads allocating and freeing at once, with and without thread caches and arenas */
+int test_threads(int argc, char **argv)
+{
+	strategies strategy;
+	int lbound = 1;
+	int ubound = 7;
+	int caching;
+	int arenas;
+
+	if (strategyFromString(*(argv + 1)) > 0)
+		lbound = ubound = strategyFromString(*(argv + 1));
+
+	for (strategy = lbound; strategy <= ubound; strategy++)
+	{
+		for (caching = 0; caching <= 1; caching++)
+		for (arenas = 1; arenas <= 4; arenas += 3)
+		{
+			struct mem_options options = {ListLayout, caching, arenas};
+			pthread_t threads[THREADS];
+			long i;
+
+			initmem_opts(strategy, 1 << 20, &options);
+			memset(threadBlocks, 0, sizeof(threadBlocks));
+			pthread_barrier_init(&threadBarrier, NULL, THREADS);
+
+			for (i = 0; i < THREADS; i++)
+				pthread_create(&threads[i], NULL, thread_worker, (void *)i);
+			for (i = 0; i < THREADS; i++)
+				pthread_join(threads[i], NULL);
+			pthread_barrier_destroy(&threadBarrier);
+
+			if (threadErrors)
+			{
+				printf("Blocks overlapped between threads with %s\n", strategy_name(strategy));
+				return 1;
+			}
+
+			/* exiting threads return their caches, so the pool must be empty again: one hole per arena */
+			if (mem_allocated() != 0 || mem_holes() != arenas)
+			{
+				printf("Pool not empty after threads exited (%d bytes in %d holes) with %s, %d arenas%s\n", mem_allocated(), mem_holes(), strategy_name(strategy), arenas, caching ? " and thread caches" : "");
+				return 1;
+			}
+
+			/* holes never span arenas, but the range query does */
+			if (mem_is_alloc_range(mem_pool(), mem_total()) != MEM_RANGE_FREE || mem_largest_free() != (1 << 20) / arenas)
+			{
+				printf("Arena statistics do not add up with %s, %d arenas\n", strategy_name(strategy), arenas);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
 int run_memory_tests(int argc, char **argv)
 {
 	if (argc < 3)
@@ -454,7 +2294,32 @@ int run_memory_tests(int argc, char **argv)
 		{"alloc2", "suite2", test_alloc_2},
 		{"alloc3", "suite1", test_alloc_3},
 		{"alloc4", "suite2", test_alloc_4},
+		{"free1", "suite2", test_free_invalid},
+		{"small1", "suite2", test_small_free},
+		{"range1", "suite2", test_alloc_range},
+		{"tags1", "suite2", test_tags},
+		{"realloc1", "suite2", test_realloc},
+		{"align1", "suite2", test_align},
+		{"calloc1", "suite2", test_calloc},
+		{"compact1", "suite2", test_compact},
+		{"batch1", "suite2", test_batch},
+		{"sized1", "suite2", test_free_sized},
+		{"lazy1", "suite2", test_lazy},
+		{"grow1", "suite2", test_grow},
+		{"trim1", "suite2", test_trim},
+		{"file1", "suite2", test_file},
+		{"shared1", "suite2", test_shared},
+		{"threads1", "suite2", test_threads},
+		{"bitmap1", "suite2", test_bitmap},
+		{"buddy1", "suite2", test_buddy},
+		{"tlsf1", "suite2", test_tlsf},
 		{"stress", "suite3", do_stress_tests},
+		{"stresstags", "suite3", do_stress_tests_tags},
+		{"stressalign", "suite3", do_stress_tests_aligned},
+		{"stresslazy", "suite3", do_stress_tests_lazy},
+		{"latency", "suite3", do_latency_benchmark},
+		{"batch", "suite3", do_batch_benchmark},
+		{"hugepages", "suite3", do_hugepage_benchmark},
 	};
 
 	return run_testrunner(argc, argv, tests, sizeof(tests) / sizeof(testentry_t));
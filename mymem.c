@@ -1,8 +1,19 @@
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mymem.h"
+#include "mymem_tags.h"
+#include "mymem_bitmap.h"
 #include <time.h>
 
 /* The main structure for implementing memory allocation.
@@ -14,8 +25,66 @@ struct memoryList *find_block_next(size_t requested);
 struct memoryList *find_block_worst(size_t requested);
 struct memoryList *find_block_first(size_t requested);
 struct memoryList *find_block_best(size_t requested);
+struct memoryList *find_block_bitmap(size_t requested);
+struct memoryList *find_block_buddy(size_t requested);
+struct memoryList *find_block_tlsf(size_t requested);
+static void buddy_carve(struct memoryList *node);
+static struct memoryList *buddy_of(struct memoryList *node);
 void *free_adjacent(struct memoryList *trav);
 void insertBlock(struct memoryList *block, size_t requested);
+static struct memoryList *allocate_block(size_t requested, char *zeroed);
+static struct memoryList *allocate_aligned(size_t alignment, size_t requested);
+static struct memoryList *allocate_any(size_t requested);
+static size_t align_size(size_t size);
+static void release_block(struct memoryList *trav);
+static void free_block(void *block, int trusted, const size_t *hint);
+static int size_fits(void *block, size_t size, size_t requested, size_t usable);
+static struct memoryList *release_unfiled(struct memoryList *trav, struct memoryList *pending);
+static struct memoryList *merge_unfiled(struct memoryList *trav, struct memoryList *pending);
+static struct memoryList *find_block(size_t size);
+static void quick_push(struct memoryList *node);
+static void quick_remove(struct memoryList *node);
+static void merge_next(struct memoryList *node);
+static void quick_flush();
+static int init_pool(strategies strategy, size_t sz, const struct mem_options *options, const char *path, int shared);
+static size_t trim_block(struct memoryList *node);
+static void file_released(struct memoryList *node);
+static struct memoryList *split_allocated(struct memoryList *node, size_t size);
+static void handle_release(mem_handle handle);
+static int resize_block(struct memoryList *node, size_t newsize);
+static void *cache_malloc(size_t requested);
+static int cache_free(void *block, const size_t *hint);
+static int cache_free_remote(void *block, const size_t *hint);
+static int cache_push_remote(struct memoryList *node);
+struct addressTable;
+static void table_init(struct addressTable *table);
+static void table_insert(struct addressTable *table, struct memoryList *node);
+static struct memoryList *table_lookup(struct addressTable *table, void *ptr);
+static struct memoryList *table_peek(struct addressTable *table, void *ptr);
+static void table_remove(struct addressTable *table, struct memoryList *node);
+static void table_free(struct addressTable *table);
+static void table_settle(struct addressTable *table);
+static int bin_index(size_t size);
+static void index_insert(struct memoryList *node);
+static void index_remove(struct memoryList *node);
+static struct memoryList *index_lookup(void *ptr);
+static void freelist_insert(struct memoryList *node);
+static void freelist_remove(struct memoryList *node);
+static struct memoryList *node_alloc();
+static int node_reserve(size_t count);
+static void table_reserve(struct addressTable *table, size_t entries);
+static void node_release(struct memoryList *node);
+struct radixBitmap;
+static void radix_init(struct radixBitmap *map, size_t bits);
+static void radix_set(struct radixBitmap *map, size_t bit);
+static void radix_clear(struct radixBitmap *map, size_t bit);
+static long radix_next(struct radixBitmap *map, int level, size_t bit);
+static long radix_prev(struct radixBitmap *map, int level, long bit);
+static void page_map_insert(struct memoryList *node);
+static void page_map_remove(struct memoryList *node);
+static int free_start_between(size_t from, size_t to);
+static struct memoryList *tree_lower_bound(size_t requested);
+static struct memoryList *tree_largest();
 
 struct memoryList
 {
@@ -27,16 +96,528 @@ struct memoryList
 	char alloc; // 1 if this block is allocated,
 				// 0 if this block is free.
 	void *ptr;	// location of block in memory pool.
+	int requested; // bytes asked for when the block was allocated; less than size after rounding
+	char zeroed;   // 1 while the block is free and every byte of it is known to be zero
+	mem_handle handle; // for a movable block, its slot in the handle table; otherwise 0
+
+	// lazy coalescing: a free block that has not been merged yet sits on the quick list for its size
+	char quick;
+	struct memoryList *quickPrev;
+	struct memoryList *quickNext;
+
+	// size-class free list, only used while the block is free
+	struct memoryList *prevFree;
+	struct memoryList *nextFree;
+
+	// size-ordered treap of free blocks, keyed by (size, ptr)
+	struct memoryList *treeLeft;
+	struct memoryList *treeRight;
+	unsigned int treePriority;
+	int treeCount; // number of blocks in this subtree, for rank queries
+
+	// per-thread caching, see struct threadCache
+	_Atomic(struct threadCache *) owner; // thread holding this allocated block, or NULL
+	struct memoryList *remoteNext; // link in the owner's queue of remote frees
+	char cached;					 // 1 while the block sits unused in its owner's cache
 };
 
 strategies myStrategy = NotSet; // Current strategy
+layouts myLayout = ListLayout;	// Where block metadata is kept
 
 size_t mySize;
 void *myMemory = NULL;
 
-static struct memoryList *head;
-static struct memoryList *currentnode;
-static struct memoryList *largestFree;
+// the pool is mapped straight from the kernel, so it starts out zero
+static void *poolMapping;
+static size_t poolMappingSize;
+
+/* Every block starts on a multiple of minAlign: the pool is page aligned,
+ * arenas are a multiple of it, and block sizes are rounded up to it.
+ */
+#define POOL_ALIGN 4096
+static size_t minAlign = 1;
+
+/* Trimming: the whole pages inside a free block can be given back to the OS
+ * with madvise, and come back zero filled when they are touched again.
+ * mem_trim does this for every free block; with mem_options.trim_threshold a
+ * block that large is trimmed as soon as it is freed.
+ */
+static size_t pageSize;
+static size_t trimThreshold;
+
+/* Huge pages (mem_options.huge_pages): the pool is mapped on a HUGE_PAGE
+ * boundary and marked with MADV_HUGEPAGE, so that the kernel can back it
+ * with transparent huge pages and a large pool needs far fewer TLB entries.
+ * Without THP support the advice fails and the pool keeps normal pages.
+ */
+#define HUGE_PAGE (2 << 20)
+static int hugePages; // 1 to ask for huge pages, -1 to refuse them, 0 for the kernel's default
+
+/* File-backed pools (initmem_file): the file holds a fileHeader in its first
+ * page and the pool after it. The pool uses the tag layout, whose metadata
+ * is all offsets inside the pool, so the heap works wherever the file is
+ * mapped. The file is mapped privately: changes stay in memory until
+ * mem_sync writes a whole new snapshot.
+ */
+#define FILE_MAGIC "mymem01"
+#define FILE_HEADER POOL_ALIGN
+struct fileHeader
+{
+	char magic[8];
+	size_t size; // bytes in the pool
+	size_t root; // offset of the root block in the pool, 0 for none
+};
+static char *poolPath; // file behind the pool, NULL for an anonymous pool
+static int poolWarm;   // the heap in the pool came from the file (or another process) and is already set up
+
+/* Shared pools (initmem_shared): a shm_open object mapped MAP_SHARED by every
+ * process that uses it, with a sharedHeader in its first page and the pool
+ * after it. As with file-backed pools the pool uses the tag layout, so all
+ * the heap state is inside the pool and made of offsets; only the lock has
+ * to move out of struct arena, into the header, where it is process-shared.
+ * The lock is robust: if a process dies holding it, the next one to lock it
+ * repairs the heap (see tag_repair) before going on.
+ */
+#define SHARED_HEADER POOL_ALIGN
+#define SHARED_WAIT_MS 1000 // how long an attaching process waits for the creator
+struct sharedHeader
+{
+	atomic_int ready; // set by the creator once the heap is set up
+	size_t size;	  // bytes in the pool
+	pthread_mutex_t lock;
+};
+static struct sharedHeader *poolShared; // header of a shared pool, NULL otherwise
+
+/* Node slab: list nodes are carved from cache-line aligned chunks that belong
+ * to the pool instead of being malloc'ed from libc one at a time. Released
+ * nodes are kept on freeNodes for reuse, and initmem frees whole chunks.
+ * TLSF sets up its arenas with a chunk and an address index large enough for
+ * one block per TLSF_BLOCK_ESTIMATE bytes, so that up to that many blocks no
+ * allocation or free has to call into libc.
+ */
+#define CACHE_LINE 64
+#define CHUNK_NODES 256
+#define TLSF_BLOCK_ESTIMATE 256
+struct nodeChunk
+{
+	struct nodeChunk *next;
+	struct memoryList *nodes; // first node, one cache line into the chunk
+};
+
+/* Address index: an open-addressing hash table (linear probing) from a block's
+ * ptr to its node, so that myfree can find its node without walking the list.
+ * The capacity is always a power of two and is kept at most half full.
+ * Growing does not rehash in one go: the old slots stay in use beside the new
+ * table, twice as large, and every insert moves up to INDEX_MIGRATE_STEPS of
+ * them over, which empties the old slots long before the new table fills up.
+ * No single insert pays for the whole table, which keeps TLSF's worst case
+ * bounded.
+ */
+#define INDEX_MIN_CAPACITY 64
+#define INDEX_MIGRATE_STEPS 4
+struct addressTable
+{
+	struct memoryList **slots;
+	size_t capacity;
+	size_t count; // entries in slots and oldSlots together
+
+	// the slots before the last growth, until every entry has moved; NULL otherwise
+	struct memoryList **oldSlots;
+	size_t oldCapacity;
+	size_t oldCount;
+	size_t migrated; // old slots below this one are empty
+
+	struct retiredSlots *retired; // slot arrays waiting for remote lookups to finish, see remoteLookups
+};
+struct retiredSlots
+{
+	struct retiredSlots *next;
+	struct memoryList **slots;
+};
+
+/* Page map: every PAGE_MAP_UNIT bytes of an arena are a page, and pageFirst
+ * holds the lowest block that starts in each page (NULL if none does). Radix
+ * bitmaps over the pages mark those with a block start (blockPages) and those
+ * with a free block start (freePages, counted in pageFreeStarts). Level 0 has
+ * one bit per page; every level above has one bit per word of the level
+ * below, set when that word is non-zero, up to a single top word, so the
+ * nearest marked page on either side takes one word scan per level. The
+ * block owning a byte is then found from the nearest page at or before it
+ * with a block start, walking only the blocks that start in that page.
+ */
+#define PAGE_MAP_UNIT 4096
+#define RADIX_MAX_LEVELS 12
+struct radixBitmap
+{
+	int levels;
+	size_t bits[RADIX_MAX_LEVELS];
+	unsigned long long *words[RADIX_MAX_LEVELS];
+};
+
+/* Segregated free lists: every free block sits in the bin of its size class.
+ * Classes are split two-level, by power of two and then into BIN_SUBCLASSES
+ * linear steps, so that a bin never holds blocks more than 25% apart in size.
+ * binMap has a bit set for every non-empty bin.
+ */
+#define BIN_SUBCLASS_LOG 2
+#define BIN_SUBCLASSES (1 << BIN_SUBCLASS_LOG)
+#define BIN_COUNT 256
+#define BIN_MAP_WORDS (BIN_COUNT / 64)
+#define BIN_GROUPS (BIN_COUNT / BIN_SUBCLASSES) // one per power of two
+#define QUICK_MAX 1024
+
+/* Per-thread caches (mem_options.thread_cache, list layout only).
+ * A thread keeps the blocks it frees in small per-size-class bins and serves
+ * later requests of the same class from them without taking an arena lock. To the
+ * rest of the pool these blocks stay allocated. Every block a thread holds,
+ * in use or cached, is recorded in its owned table, which is how myfree
+ * recognises its own blocks without a shared lookup. A block freed by
+ * another thread is found in its arena's address index without the arena
+ * lock (table_peek) and pushed onto its owner's remoteFrees stack with a
+ * compare-and-swap, and the owner takes the whole stack back on its next
+ * call. Full bins are flushed back to the pool in one locked batch.
+ */
+#define CACHE_BIN_LIMIT 32
+struct threadCache
+{
+	struct memoryList *bins[BIN_COUNT]; // cached blocks, linked through nextFree
+	int binCounts[BIN_COUNT];
+	struct addressTable owned;
+	_Atomic(struct memoryList *) remoteFrees;
+	unsigned int generation; // pool generation the cache belongs to
+};
+
+static int threadCaching;
+static int lazyLimit; // blocks that may wait unmerged per arena, 0 when merging at once
+static unsigned int poolGeneration;
+static __thread struct threadCache *myCache;
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+
+/* Remote frees read another arena's address index and a block's owner
+ * without a lock, registered in remoteLookups[remoteEpoch] meanwhile. An
+ * exiting thread disowns its blocks, flips the epoch and waits until the
+ * lookups registered under the old one are done, after which none can still
+ * push onto its cache. Slot arrays an index no longer uses are only freed
+ * while no lookup is registered at all.
+ */
+static atomic_int remoteEpoch;
+static atomic_int remoteLookups[2];
+static pthread_mutex_t epochLock = PTHREAD_MUTEX_INITIALIZER; // one exiting thread flips the epoch at a time
+
+/* Arenas (mem_options.arenas): the pool is split into equal slices, each with
+ * its own block list, indexes, statistics and lock, so that threads working in
+ * different arenas never wait for each other. Threads are handed an arena
+ * round-robin on their first call, and a block is always freed back to the
+ * arena whose slice holds it. Without the option the whole pool is one arena.
+ */
+struct arena
+{
+	pthread_mutex_t lock;
+	pthread_mutex_t *sharedLock; // in a shared pool, the lock in the shared header, taken instead of lock
+	void *base; // this arena's slice of myMemory, or its segment
+	size_t size;
+
+	// a segment added by growth has a mapping of its own; slices of myMemory have none
+	void *mapping;
+	size_t mappingSize;
+
+	struct memoryList *head;
+	struct memoryList *currentnode;
+
+	struct nodeChunk *nodeChunks;
+	struct memoryList *freeNodes;
+	size_t chunkNodes; // nodes in the newest chunk
+	size_t chunkNodesUsed;
+
+	struct addressTable addrIndex;
+	struct memoryList **pageFirst;
+	unsigned short *pageFreeStarts;
+	struct radixBitmap blockPages;
+	struct radixBitmap freePages;
+
+	struct memoryList *freeBins[BIN_COUNT];
+	int binCounts[BIN_COUNT];
+	unsigned long long binMap[BIN_MAP_WORDS];
+	unsigned long long groupMap; // a bit per power of two with a non-empty bin, the TLSF first level
+
+	/* The same free blocks are also kept in a treap ordered by (size, ptr), which
+	 * turns best-fit into a lower-bound lookup and worst-fit into a maximum lookup.
+	 * TLSF keeps them in a size trie instead, through the same fields.
+	 */
+	struct memoryList *freeTree;
+	unsigned int treeSeed;
+
+	// Bitmap strategy only: one bit per byte of the arena, set while the byte is free
+	unsigned long long *freeMap;
+
+	/* Lazy coalescing: freed blocks up to QUICK_MAX bytes stay unmerged, filed
+	 * as usual and also on a list per exact size, until they are merged in one
+	 * go when an allocation misses or quickBlocks reaches lazyLimit.
+	 */
+	struct memoryList *quickLists[QUICK_MAX + 1];
+	int quickBlocks;
+
+	/* Running statistics, kept up to date by the free block index hooks so
+	 * that the mem_* queries never have to walk the list.
+	 */
+	size_t freeBytes;
+	int freeBlocks;
+	size_t wastedBytes; // allocated beyond the requested sizes (alignment and buddy rounding)
+};
+static struct arena *arenas;
+static atomic_int arenaCount;
+static size_t arenaSpan; // bytes per arena; the last one also takes the remainder
+
+/* Growth (mem_options.grow): when no arena can serve a request, another
+ * segment is mapped and set up as an arena of its own, after the slices of
+ * myMemory. Blocks never merge across arenas, so segments stay apart even if
+ * the kernel maps them next to each other. arenas has room for SEGMENT_MAX
+ * segments from the start and never moves, and arenaCount only goes up once
+ * the new arena is ready.
+ */
+#define SEGMENT_MAX 64
+static int sliceCount; // arenas that are slices of myMemory
+static int growable;
+static size_t maxSize; // the most bytes mySize may reach; never above INT_MAX, the most the int statistics count
+static pthread_mutex_t growLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Movable blocks are reached through a handle, a slot in a table holding the
+ * block's current address. The table grows a page at a time and pages never
+ * move, so mem_deref can read it without a lock. Free slots are chained
+ * through the table; slot 0 is never handed out. A slot is written under
+ * handleLock, taken after the lock of the arena holding the block.
+ */
+#define HANDLE_PAGE 1024
+#define HANDLE_PAGES 1024
+struct handleSlot
+{
+	void *ptr;			// current address of the block, NULL while the slot is free
+	mem_handle nextFree; // next free slot, while this one is free
+};
+static struct handleSlot *handlePages[HANDLE_PAGES];
+static int handleSlots;
+static mem_handle handleFree;
+static int handlesInUse;
+static pthread_mutex_t handleLock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int nextTicket;
+static __thread int myTicket = -1;	  // round-robin arena assignment of this thread
+static __thread struct arena *arena; // the arena this thread has locked
+
+/* Map size bytes for the pool, starting on a multiple of minAlign, or of
+ * HUGE_PAGE when asking for huge pages. *mapping and *mappingSize are set to
+ * what has to be unmapped later. Returns NULL if the kernel has no memory.
+ */
+static void *map_pool(size_t size, void **mapping, size_t *mappingSize)
+{
+	size_t align = hugePages > 0 && minAlign < HUGE_PAGE ? HUGE_PAGE : minAlign;
+
+	// mappings are page aligned; larger alignments map a little more and skip ahead
+	*mappingSize = (size ? size : 1) + (align > POOL_ALIGN ? align : 0);
+	*mapping = mmap(NULL, *mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (*mapping == MAP_FAILED)
+	{
+		*mapping = NULL;
+		return NULL;
+	}
+
+	char *base = (char *)*mapping + (-(size_t)*mapping & (align - 1));
+
+	// only advice: the pool works the same with whatever pages it gets
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+	if (hugePages)
+		madvise(base, size, hugePages > 0 ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#endif
+	return base;
+}
+
+/* Map the pool of a file-backed pool, setting *mapping and *mappingSize as
+ * map_pool does. A file that holds a snapshot of *sz bytes (or of any size,
+ * if *sz is 0) is mapped as it is and *warm is set. Only if there is no file
+ * at path is a new pool of *sz bytes made in memory, and the file is then
+ * written by the first mem_sync. Returns NULL if the file cannot be read, is
+ * not a snapshot or holds one of another size, so that nothing but the pool's
+ * own snapshot is ever replaced.
+ */
+static void *map_file(const char *path, size_t *sz, void **mapping, size_t *mappingSize, int *warm)
+{
+	struct fileHeader header;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	*mapping = MAP_FAILED;
+	if (fd >= 0)
+	{
+		if (!fstat(fd, &st) && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+			!memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) && header.size && (*sz == 0 || header.size == *sz) &&
+			(size_t)st.st_size >= FILE_HEADER + header.size)
+		{
+			*sz = header.size;
+			*mappingSize = FILE_HEADER + header.size;
+			*mapping = mmap(NULL, *mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			*warm = 1;
+		}
+		close(fd);
+	}
+	else if (*sz && errno == ENOENT)
+	{
+		*mappingSize = FILE_HEADER + *sz;
+		*mapping = mmap(NULL, *mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (*mapping != MAP_FAILED)
+		{
+			memcpy(((struct fileHeader *)*mapping)->magic, FILE_MAGIC, sizeof(header.magic));
+			((struct fileHeader *)*mapping)->size = *sz;
+		}
+	}
+
+	if (*mapping == MAP_FAILED)
+	{
+		*mapping = NULL;
+		*warm = 0;
+		return NULL;
+	}
+	return (char *)*mapping + FILE_HEADER;
+}
+
+/* Map the pool of a shared pool, setting *mapping and *mappingSize as
+ * map_pool does. The first process to open the object named name creates it
+ * with *sz bytes and sets up the heap; the others wait for that and attach,
+ * taking the size from the object if *sz is 0, and set *warm. Returns NULL if
+ * the object cannot be created or opened, or has another size.
+ */
+static void *map_shared(const char *name, size_t *sz, void **mapping, size_t *mappingSize, int *warm)
+{
+	struct sharedHeader *header;
+	struct stat st;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	int creator = fd >= 0;
+
+	if (!creator && errno == EEXIST)
+		fd = shm_open(name, O_RDWR, 0600);
+	if (fd < 0)
+		return NULL;
+
+	if (creator)
+	{
+		if (*sz == 0 || ftruncate(fd, SHARED_HEADER + *sz))
+		{
+			close(fd);
+			shm_unlink(name);
+			return NULL;
+		}
+	}
+	else
+	{
+		// the creator may not have sized the object yet, or may have died before it did
+		for (int waited = 0; !fstat(fd, &st) && st.st_size == 0 && waited < SHARED_WAIT_MS; waited++)
+			nanosleep(&(struct timespec){0, 1000000}, NULL);
+		if (st.st_size <= SHARED_HEADER || (*sz && (size_t)st.st_size != SHARED_HEADER + *sz))
+		{
+			close(fd);
+			return NULL;
+		}
+		*sz = st.st_size - SHARED_HEADER;
+	}
+
+	*mappingSize = SHARED_HEADER + *sz;
+	*mapping = mmap(NULL, *mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (*mapping == MAP_FAILED)
+	{
+		*mapping = NULL;
+		if (creator)
+			shm_unlink(name);
+		return NULL;
+	}
+
+	header = *mapping;
+	if (creator)
+	{
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&header->lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+		header->size = *sz;
+	}
+	else
+	{
+		for (int waited = 0; !atomic_load(&header->ready); waited++)
+		{
+			if (waited == SHARED_WAIT_MS)
+			{
+				munmap(*mapping, *mappingSize);
+				*mapping = NULL;
+				return NULL;
+			}
+			nanosleep(&(struct timespec){0, 1000000}, NULL);
+		}
+		*warm = 1;
+	}
+	return (char *)*mapping + SHARED_HEADER;
+}
+
+/* Set up an arena over size bytes at base, as one free block. Makes it the
+ * calling thread's arena.
+ */
+static void arena_init(struct arena *target, void *base, size_t size)
+{
+	arena = target;
+	pthread_mutex_init(&arena->lock, NULL);
+	if (poolShared)
+		arena->sharedLock = &poolShared->lock;
+	arena->base = base;
+	arena->size = size;
+
+	if (myLayout == TagLayout)
+	{
+		if (!poolWarm)
+			tag_init(arena->base, arena->size);
+		return;
+	}
+
+	arena->chunkNodes = arena->chunkNodesUsed = 0;
+	arena->treeSeed = 2463534242u;
+
+	table_init(&arena->addrIndex);
+	if (myStrategy == TLSF)
+	{
+		node_reserve(arena->size / TLSF_BLOCK_ESTIMATE + 1);
+		table_reserve(&arena->addrIndex, arena->size / TLSF_BLOCK_ESTIMATE + 1);
+	}
+
+	arena->head = node_alloc();
+	arena->head->size = arena->size;
+	arena->head->alloc = 0;
+	arena->head->ptr = arena->base;
+	arena->head->zeroed = 1;
+	arena->head->handle = 0;
+	arena->head->quick = 0;
+	arena->currentnode = arena->head;
+
+	arena->head->prev = arena->head;
+	arena->head->next = arena->head;
+
+	size_t pages = (arena->size + PAGE_MAP_UNIT - 1) / PAGE_MAP_UNIT;
+	arena->pageFirst = calloc(pages, sizeof(struct memoryList *));
+	arena->pageFreeStarts = calloc(pages, sizeof(unsigned short));
+	radix_init(&arena->blockPages, pages);
+	radix_init(&arena->freePages, pages);
+
+	index_insert(arena->head);
+
+	if (myStrategy == Buddy)
+		buddy_carve(arena->head);
+	else
+		freelist_insert(arena->head);
+
+	if (myStrategy == Bitmap)
+	{
+		arena->freeMap = calloc((arena->size + 63) / 64, sizeof(unsigned long long));
+		bitmap_set_range(arena->freeMap, 0, arena->size);
+	}
+}
 
 /* initmem must be called prior to mymalloc and myfree.
    initmem may be called more than once in a given exeuction;
@@ -47,359 +628,3345 @@ static struct memoryList *largestFree;
 		- "worst" (worst-fit)
 		- "first" (first-fit)
 		- "next" (next-fit)
+		- "bitmap" (first-fit, found in a bitmap of free bytes)
+		- "buddy" (binary buddy system)
+		- "tlsf" (two-level segregated fit)
    sz specifies the number of bytes that will be available, in total, for all mymalloc requests.
 */
 
 void initmem(strategies strategy, size_t sz)
 {
+	initmem_opts(strategy, sz, NULL);
+}
+
+/* initmem with extra settings; options may be NULL for the defaults.
+   With TagLayout the block metadata is kept inside the sz bytes of the pool,
+   see mymem_tags.c. With grow, sz is only where the pool starts.
+*/
+void initmem_opts(strategies strategy, size_t sz, const struct mem_options *options)
+{
+	init_pool(strategy, sz, options, NULL, 0);
+}
+
+// Release the pool and everything kept about it, including the arenas and handles.
+static void release_pool()
+{
+	// blocks cached by any thread belong to the old pool; caches notice the new generation and start over
+	poolGeneration++;
+
+	// clear memory used by previous iterations
+	if (poolMapping)
+		munmap(poolMapping, poolMappingSize); /* in case this is not the first time initmem2 is called */
+	poolMapping = NULL;
+
+	for (int i = 0; i < arenaCount; i++)
+	{
+		arena = &arenas[i];
+
+		// every list node lives in a chunk, so this releases the whole list
+		while (arena->nodeChunks)
+		{
+			struct nodeChunk *chunk = arena->nodeChunks;
+			arena->nodeChunks = chunk->next;
+			free(chunk);
+		}
+
+		table_free(&arena->addrIndex);
+
+		free(arena->pageFirst);
+		free(arena->pageFreeStarts);
+		for (int level = 0; level < arena->blockPages.levels; level++)
+		{
+			free(arena->blockPages.words[level]);
+			free(arena->freePages.words[level]);
+		}
+		free(arena->freeMap);
+
+		if (arena->mapping)
+			munmap(arena->mapping, arena->mappingSize);
+		pthread_mutex_destroy(&arena->lock);
+	}
+	free(arenas);
+	arenas = NULL;
+	arenaCount = 0;
+	free(poolPath);
+	poolPath = NULL;
+	poolWarm = 0;
+	poolShared = NULL;
+
+	// every handle pointed into the old pool
+	for (int i = 0; i < HANDLE_PAGES && handlePages[i]; i++)
+	{
+		free(handlePages[i]);
+		handlePages[i] = NULL;
+	}
+	handleSlots = handlesInUse = handleFree = 0;
+}
+
+/* Map a pool from the file at path, from the shared memory object named
+ * path if shared is set, or an anonymous pool if path is NULL, and set it up
+ * as initmem_opts describes. Returns 1 if the heap was already set up (in the
+ * file or by another process), 0 if it is new, and -1 if path could not be
+ * used; the pool from before is then left as it was.
+ */
+static int init_pool(strategies strategy, size_t sz, const struct mem_options *options, const char *path, int shared)
+{
+	void *base = NULL, *mapping = NULL;
+	size_t mappingSize = 0;
+	int warm = 0;
+
+	// a file or object is mapped before the old pool goes, so that one that cannot be used leaves it alone
+	if (shared)
+		base = map_shared(path, &sz, &mapping, &mappingSize, &warm);
+	else if (path)
+		base = map_file(path, &sz, &mapping, &mappingSize, &warm);
+	if (path && !base)
+		return -1;
+
+	release_pool();
+
 	myStrategy = strategy;
+	myLayout = options ? options->layout : ListLayout;
+	threadCaching = options ? options->thread_cache : 0;
+	minAlign = options && options->alignment > 1 ? options->alignment : 1;
+
+	pageSize = sysconf(_SC_PAGESIZE);
+	trimThreshold = options ? options->trim_threshold : 0;
+	hugePages = options ? options->huge_pages : 0;
+
+	// buddy blocks only merge with their buddies, and bitmap runs would span unmerged blocks
+	lazyLimit = options && strategy != Buddy && strategy != Bitmap ? options->lazy_coalesce : 0;
+	assert((minAlign & (minAlign - 1)) == 0);
+
+	printf("Setup memory \n");
+	if (!path)
+		base = map_pool(sz, &mapping, &mappingSize);
+	myMemory = base;
+	poolMapping = mapping;
+	poolMappingSize = mappingSize;
+	poolWarm = warm;
+	poolShared = shared ? mapping : NULL;
+	poolPath = path && !shared ? strdup(path) : NULL;
 
 	/* all implementations will need an actual block of memory to use */
 	mySize = sz;
 
-	// clear memory used by previous iterations
-	if (myMemory)
-		free(myMemory); /* in case this is not the first time initmem2 is called */
+	// arenas start on their own cache line, which also keeps the boundary tags word aligned
+	arenaCount = options && options->arenas > 1 ? options->arenas : 1;
+	arenaSpan = sz / arenaCount & ~((minAlign > CACHE_LINE ? minAlign : CACHE_LINE) - 1);
+	if (arenaSpan == 0)
+	{
+		arenaCount = 1;
+		arenaSpan = sz;
+	}
+	sliceCount = arenaCount;
+	growable = options && options->grow;
+	maxSize = growable && options->max_size && options->max_size < INT_MAX ? options->max_size : INT_MAX;
+	arenas = calloc(arenaCount + (growable ? SEGMENT_MAX : 0), sizeof(struct arena));
 
-	if (head)
-		free(head);
+	for (int i = 0; i < arenaCount; i++)
+	{
+		arena_init(&arenas[i], (char *)myMemory + i * arenaSpan, i == arenaCount - 1 ? sz - i * arenaSpan : arenaSpan);
+	}
+	arena = NULL;
 
-	printf("Setup memory \n");
-	myMemory = malloc(sz);
-	head = malloc(sizeof(struct memoryList));
-	head->size = sz;
-	head->alloc = 0;
-	head->ptr = myMemory;
-	currentnode = head;
+	// processes waiting to attach may use the heap from now on
+	if (poolShared)
+		atomic_store(&poolShared->ready, 1);
+
+	if (strategy == Bitmap && !bitmap_kernel_name())
+		bitmap_use_kernel(NULL);
+	return poolWarm;
+}
+
+/* Open a pool that lives in the file at path, for a warm restart. If the
+ * file holds a snapshot written by mem_sync, the pool is mapped from it and
+ * every block allocated at that point is still allocated, at the same offset
+ * from mem_pool(); store offsets rather than pointers in the pool, and find
+ * the data again through mem_root. If there is no file at path, a new pool of
+ * sz bytes is made and written to it. sz 0 takes the size of the snapshot.
+ * Any other file, or a snapshot of another size, is left as it is and the
+ * call fails.
+ * File-backed pools always use the tag layout, in one arena, and so cannot
+ * use the buddy system. Returns 1 if the pool was reopened, 0 if it is new,
+ * and -1 if path cannot be used, leaving the pool from before as it was. A
+ * new pool that could not be written to path yet also returns -1, but is set
+ * up all the same, and a later mem_sync may still write it.
+ */
+int initmem_file(const char *path, strategies strategy, size_t sz)
+{
+	struct mem_options options = {TagLayout};
+
+	if (strategy == Buddy)
+	{
+		fprintf(stderr, "initmem_file: the boundary-tag layout has no buddy system\n");
+		return -1;
+	}
+
+	int warm = init_pool(strategy, sz, &options, path, 0);
+	if (warm == 0 && mem_sync())
+		return -1;
+	return warm;
+}
+
+/* Open a pool that several processes allocate from at once, in the POSIX
+ * shared memory object named name (see shm_open). The first process creates
+ * it with sz bytes; the others, and children forked after initmem_shared,
+ * share its blocks, and any process may free any block. The pool can be
+ * mapped at a different address in each process, so pass blocks between
+ * processes as offsets from mem_pool(). sz 0 attaches to an existing pool of
+ * any size. Shared pools use the tag layout in one arena, so not the buddy
+ * system. Remove the object with shm_unlink once no process needs it.
+ * Blocks held by a process that dies stay allocated. An attaching process
+ * gives up if the creator has not set the pool up within SHARED_WAIT_MS.
+ * Returns 1 if an existing pool was attached, 0 if it was created, and -1
+ * on failure, leaving the pool from before as it was.
+ */
+int initmem_shared(const char *name, strategies strategy, size_t sz)
+{
+	struct mem_options options = {TagLayout};
 
-	head->prev = head;
-	head->next = head;
+	if (strategy == Buddy)
+	{
+		fprintf(stderr, "initmem_shared: the boundary-tag layout has no buddy system\n");
+		return -1;
+	}
+
+	return init_pool(strategy, sz, &options, name, 1);
+}
+
+// Lock an arena and make it the one the calling thread works in.
+static struct arena *arena_enter(struct arena *target)
+{
+	if (!target->sharedLock)
+	{
+		pthread_mutex_lock(&target->lock);
+	}
+	else if (pthread_mutex_lock(target->sharedLock) == EOWNERDEAD)
+	{
+		// another process died holding the lock, perhaps halfway through changing the heap
+		if (tag_repair(target->base) < 0)
+			fprintf(stderr, "arena_enter: shared pool damaged by a dead process, its end is given up\n");
+		pthread_mutex_consistent(target->sharedLock);
+	}
+	arena = target;
+	return target;
+}
+
+static void arena_leave()
+{
+	pthread_mutex_unlock(arena->sharedLock ? arena->sharedLock : &arena->lock);
+	arena = NULL;
+}
+
+// Index of the arena the calling thread allocates from first.
+static int thread_arena()
+{
+	if (myTicket < 0)
+		myTicket = atomic_fetch_add(&nextTicket, 1);
+	return myTicket % arenaCount;
+}
+
+// The arena whose slice or segment holds ptr, or NULL for pointers outside the pool.
+static struct arena *arena_of(void *ptr)
+{
+	struct arena *last = &arenas[sliceCount - 1];
+
+	if ((char *)ptr >= (char *)myMemory && (char *)ptr < (char *)last->base + last->size)
+	{
+		size_t i = ((char *)ptr - (char *)myMemory) / arenaSpan;
+		return &arenas[i < sliceCount ? i : sliceCount - 1];
+	}
+
+	for (int i = sliceCount; i < arenaCount; i++)
+	{
+		if ((char *)ptr >= (char *)arenas[i].base && (char *)ptr < (char *)arenas[i].base + arenas[i].size)
+			return &arenas[i];
+	}
+	return NULL;
+}
+
+/* Map a new segment with room for a block of bytes bytes and return its
+ * arena, unlocked, or NULL if the pool may not grow that far. A segment is
+ * as large as the whole pool so far, so the pool doubles each time, or twice
+ * the block if that is more; the slack covers buddy rounding, alignment
+ * padding and the tag heap state.
+ */
+static struct arena *grow_pool(size_t bytes)
+{
+	struct arena *segment = NULL;
+
+	if (!growable || bytes > maxSize / 2)
+		return NULL;
+
+	pthread_mutex_lock(&growLock);
+
+	size_t size = 2 * bytes > mySize ? 2 * bytes : mySize;
+	size = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+
+	// near the limit, a last segment takes whatever is left
+	if (mySize > maxSize || size > maxSize - mySize)
+		size = maxSize > mySize ? maxSize - mySize : 0;
+
+	if (arenaCount - sliceCount < SEGMENT_MAX && size >= 2 * bytes)
+	{
+		void *mapping;
+		size_t mappingSize;
+		void *base = map_pool(size, &mapping, &mappingSize);
+
+		if (base)
+		{
+			segment = &arenas[arenaCount];
+			arena_init(segment, base, size);
+			segment->mapping = mapping;
+			segment->mappingSize = mappingSize;
+			arena = NULL;
+
+			mySize += size;
+			arenaCount++;
+		}
+	}
+
+	pthread_mutex_unlock(&growLock);
+	return segment;
+}
+
+/* The i-th arena an allocation of bytes bytes tries: the count arenas there
+ * were when it started, from its home arena on, and then a new segment if the
+ * pool may grow. NULL once there is nothing left to try.
+ */
+static struct arena *arena_at(int home, int i, int count, size_t bytes)
+{
+	if (i < count)
+		return &arenas[(home + i) % count];
+	return i == count ? grow_pool(bytes) : NULL;
 }
 
 /* Allocate a block of memory with the requested size.
  *  If the requested block is not available, mymalloc returns NULL.
  *  Otherwise, it returns a pointer to the newly allocated block.
  *  Restriction: requested >= 1 
+ *  mymalloc and myfree may be called from several threads at once.
  */
 
-void *mymalloc(size_t requested)
+void *mymalloc(size_t requested)
+{
+	void *block = NULL;
+
+	assert((int)myStrategy > 0);
+
+	if (threadCaching && myLayout == ListLayout)
+	{
+		return cache_malloc(requested);
+	}
+
+	// start in the thread's own arena and move on to the others when it is full
+	int home = thread_arena();
+	int count = arenaCount;
+	struct arena *target;
+	for (int i = 0; !block && (target = arena_at(home, i, count, requested)); i++)
+	{
+		arena_enter(target);
+		if (myLayout == TagLayout)
+		{
+			block = tag_memalign(arena->base, myStrategy, minAlign, requested);
+		}
+		else
+		{
+			struct memoryList *matching_block = allocate_block(requested, NULL);
+			block = matching_block ? matching_block->ptr : NULL;
+		}
+		arena_leave();
+	}
+
+	// movable blocks may be cutting the free space into pieces: compact and try again
+	if (!block && handlesInUse)
+	{
+		mem_compact();
+		struct memoryList *node = allocate_any(requested);
+		block = node ? node->ptr : NULL;
+	}
+
+	// Our search didn't yield a compatible block, log this and do not allocate any memory.
+	if (!block)
+		fprintf(stderr, "No suitable block found \n");
+
+	return block;
+}
+
+/* Allocate a block of size bytes whose address is a multiple of alignment,
+ * which must be a power of two. Alignments up to the pool's minimum (see
+ * mem_options) are what mymalloc gives anyway. Free the block with myfree.
+ */
+void *mymemalign(size_t alignment, size_t size)
+{
+	void *block = NULL;
+
+	assert((int)myStrategy > 0);
+
+	if (alignment == 0 || (alignment & (alignment - 1)))
+	{
+		fprintf(stderr, "mymemalign: alignment %zu is not a power of two\n", alignment);
+		return NULL;
+	}
+	if (alignment <= minAlign)
+		return mymalloc(size);
+
+	int home = thread_arena();
+	int count = arenaCount;
+	struct arena *target;
+	for (int i = 0; !block && (target = arena_at(home, i, count, size + alignment)); i++)
+	{
+		arena_enter(target);
+		if (myLayout == TagLayout)
+		{
+			block = tag_memalign(arena->base, myStrategy, alignment, size);
+		}
+		else
+		{
+			struct memoryList *node = allocate_aligned(alignment, size);
+			block = node ? node->ptr : NULL;
+		}
+		arena_leave();
+	}
+
+	if (!block)
+		fprintf(stderr, "No suitable block found \n");
+
+	return block;
+}
+
+/* Allocate a zeroed block for n elements of size bytes each. Returns NULL if
+ * the product overflows or is zero, or if no block is large enough.
+ * Blocks carved from memory that was never handed out are already zero, so
+ * only blocks that were used before are cleared.
+ */
+void *mycalloc(size_t n, size_t size)
+{
+	void *block = NULL;
+	size_t bytes = n * size;
+	char zeroed = 0;
+
+	assert((int)myStrategy > 0);
+
+	if (bytes == 0 || bytes / size != n)
+	{
+		fprintf(stderr, "mycalloc: cannot allocate %zu blocks of %zu bytes\n", n, size);
+		return NULL;
+	}
+
+	// cached blocks and boundary-tag blocks carry no zero flag, so they are always cleared
+	if (threadCaching || myLayout == TagLayout)
+	{
+		block = mymalloc(bytes);
+		if (block)
+			memset(block, 0, bytes);
+		return block;
+	}
+
+	int home = thread_arena();
+	int count = arenaCount;
+	struct arena *target;
+	for (int i = 0; !block && (target = arena_at(home, i, count, bytes)); i++)
+	{
+		arena_enter(target);
+		struct memoryList *node = allocate_block(bytes, &zeroed);
+		block = node ? node->ptr : NULL;
+		arena_leave();
+	}
+
+	if (!block)
+	{
+		fprintf(stderr, "No suitable block found \n");
+		return NULL;
+	}
+
+	if (!zeroed)
+		memset(block, 0, bytes);
+	return block;
+}
+
+/* Find a block with the current strategy and mark it allocated, splitting off
+ * any leftover memory as a new free block. If zeroed is not NULL, it is set to
+ * whether the block is known to be all zero. Caller holds the arena lock.
+ */
+static struct memoryList *allocate_block(size_t requested, char *zeroed)
+{
+	// Set up a pointer to the block that we will allocate this memory to
+	struct memoryList *matching_block = NULL;
+	size_t size = align_size(requested);
+
+	// a block of exactly this size that was freed lately is taken as it is
+	if (size <= QUICK_MAX && arena->quickLists[size])
+		matching_block = arena->quickLists[size];
+	else
+		matching_block = find_block(size);
+
+	// the space may be there in pieces that have not been merged yet
+	if (!matching_block && arena->quickBlocks)
+	{
+		quick_flush();
+		matching_block = find_block(size);
+	}
+
+	// Our search didn't yield a compatible block, so do not allocate any memory.
+	if (!matching_block)
+	{
+		return NULL;
+	}
+
+	// The block is about to be (partly) allocated, so it leaves its size class.
+	freelist_remove(matching_block);
+	char wasQuick = matching_block->quick;
+	if (wasQuick)
+		quick_remove(matching_block);
+
+	// Buddy: halve the block until it is the smallest power of two that holds the request
+	if (myStrategy == Buddy)
+	{
+		while (matching_block->size / 2 >= size)
+		{
+			insertBlock(matching_block, matching_block->size / 2);
+		}
+		size = matching_block->size;
+	}
+
+	// If request is smaller than this blocks current size, then we will have leftover memory. Thus we need to create a new node in the list to contain this leftover memory
+	if (matching_block->size > size)
+	{
+		insertBlock(matching_block, size);
+
+		if (wasQuick)
+			merge_next(matching_block->next);
+	}
+	// Since we will only enter this part of the code if the block that was found is exactly the size of the request -
+	// We do not need to make a new node, since the current list structure can facilitate the allocattion of the request, with memory leftover.
+	// simply update the currentnode to point to the current nodes next node. Before allocating it and returning the pointer for the matched block
+
+	// This could also be seen as (if block->size == requested)
+	else
+	{
+		arena->currentnode = matching_block->next;
+	}
+	if (arena->freeMap)
+		bitmap_clear_range(arena->freeMap, (char *)matching_block->ptr - (char *)arena->base, size);
+
+	// Indicate that the matched block has been allocated and return a pointer to it.
+	matching_block->alloc = 1;
+	matching_block->owner = NULL;
+	matching_block->cached = 0;
+	matching_block->requested = requested;
+	matching_block->handle = 0;
+	arena->wastedBytes += size - requested;
+
+	// the caller is about to write to it
+	if (zeroed)
+		*zeroed = matching_block->zeroed;
+	matching_block->zeroed = 0;
+
+	return matching_block;
+}
+
+// A free block of at least size bytes, found with the current strategy.
+static struct memoryList *find_block(size_t size)
+{
+	switch (myStrategy)
+	{
+	case First:
+		return find_block_first(size);
+	case Best:
+		return find_block_best(size);
+	case Worst:
+		return find_block_worst(size);
+	case Next:
+		return find_block_next(size);
+	case Bitmap:
+		return find_block_bitmap(size);
+	case Buddy:
+		return find_block_buddy(size);
+	case TLSF:
+		return find_block_tlsf(size);
+	default:
+		return NULL;
+	}
+}
+
+// size rounded up to the pool's minimum alignment
+static size_t align_size(size_t size)
+{
+	return (size + minAlign - 1) & ~(minAlign - 1);
+}
+
+/* Allocate a block whose address is a multiple of alignment, a power of two
+ * larger than minAlign. A block with room for the worst-case padding is
+ * found with the current strategy; the padding in front of the aligned
+ * address and whatever is left behind the request go back to the free list.
+ * Caller holds the arena lock.
+ */
+static struct memoryList *allocate_aligned(size_t alignment, size_t requested)
+{
+	struct memoryList *node;
+
+	// buddy blocks sit on multiples of their own size within the page aligned arena
+	if (myStrategy == Buddy)
+	{
+		if ((size_t)arena->base % alignment)
+			return NULL;
+
+		node = allocate_block(requested > alignment ? requested : alignment, NULL);
+		if (node)
+		{
+			arena->wastedBytes += node->requested - requested;
+			node->requested = requested;
+		}
+		return node;
+	}
+
+	node = allocate_block(requested + alignment - minAlign, NULL);
+	if (!node)
+		return NULL;
+
+	size_t padding = -(size_t)node->ptr & (alignment - 1);
+
+	// the whole block counts as requested until it is cut down to size below
+	arena->wastedBytes -= node->size - node->requested;
+	node->requested = node->size;
+
+	if (padding)
+	{
+		insertBlock(node, padding);
+		struct memoryList *aligned = node->next;
+
+		freelist_remove(aligned);
+		aligned->alloc = 1;
+		aligned->owner = NULL;
+		aligned->cached = 0;
+		aligned->requested = aligned->size;
+		node->requested = node->size;
+
+		// the padding merges with a free block in front of it, if there is one
+		release_block(node);
+		node = aligned;
+	}
+
+	resize_block(node, requested);
+	return node;
+}
+
+void myfree(void *block)
+{
+	free_block(block, 0, NULL);
+}
+
+/* myfree for callers that know the size of the block, as they asked for it
+ * in mymalloc (or last in myrealloc). The address index already leads
+ * straight to the node, so what the hint buys is skipping the checks that
+ * myfree makes on pointers it cannot trust. Builds without NDEBUG make them
+ * anyway, and also refuse a block whose size does not match the hint, in
+ * the same lookup that frees it. NULL and pointers outside the pool are
+ * ignored either way.
+ */
+void myfree_sized(void *block, size_t size)
+{
+	if (!block)
+		return;
+
+#ifndef NDEBUG
+	free_block(block, 0, &size);
+#else
+	free_block(block, 1, NULL);
+#endif
+}
+
+/* Whether an allocated block fits size, the size myfree_sized was given: its
+ * requested size exactly, or, for a block that went through a thread cache
+ * or a boundary-tag block, whose requested size is not kept (requested 0),
+ * at most its usable size. Complains if not.
+ */
+static int size_fits(void *block, size_t size, size_t requested, size_t usable)
+{
+	if (requested ? size == requested : size > 0 && size <= usable)
+		return 1;
+
+	fprintf(stderr, "myfree_sized: %p is not an allocated block of %zu bytes\n", block, size);
+	return 0;
+}
+
+/* Free a block for myfree or myfree_sized. Unless trusted, block is checked
+ * to be an allocated block of this pool first, and of the size *hint, if
+ * given; trusted or not, it has to lie inside the pool and start a block.
+ */
+static void free_block(void *block, int trusted, const size_t *hint)
+{
+	struct memoryList *trav;
+	struct arena *owner;
+
+	// blocks this thread or another one holds go back to the holder's cache without locking
+	if (threadCaching && myLayout == ListLayout && (cache_free(block, hint) || cache_free_remote(block, hint)))
+	{
+		return;
+	}
+
+	// the block goes back to the arena it came from
+	if (!(owner = arena_of(block)))
+	{
+		fprintf(stderr, "myfree: %p is not an allocated block in this pool\n", block);
+		return;
+	}
+	arena_enter(owner);
+
+	if (myLayout == TagLayout)
+	{
+		if ((!hint || size_fits(block, *hint, 0, tag_usable_size(arena->base, block))) && tag_free(arena->base, block) < 0)
+			fprintf(stderr, "myfree: %p is not an allocated block in this pool\n", block);
+		arena_leave();
+		return;
+	}
+
+	// Look the node up in the address index instead of walking the list
+	trav = index_lookup(block);
+
+	// Refuse pointers that were never handed out by mymalloc, or that have already been freed
+	if (!trav || (!trusted && (!trav->alloc || trav->cached)))
+	{
+		fprintf(stderr, "myfree: %p is not an allocated block in this pool\n", block);
+	}
+	else if (hint && !size_fits(block, *hint, trav->owner ? 0 : trav->requested, trav->size))
+	{
+		// the block stays allocated
+	}
+	// a block held by another thread goes back to that thread's cache, unless it exited meanwhile
+	else if (!trav->owner || !cache_push_remote(trav))
+	{
+		if (trav->handle)
+			handle_release(trav->handle);
+		release_block(trav);
+	}
+
+	arena_leave();
+}
+
+/* Allocate n blocks of the given sizes into out[0..n-1] and return how many
+ * were allocated; out[i] is NULL for every request that could not be met.
+ * The list layout first tries to carve all blocks from one free block, which
+ * costs one search and leaves the blocks side by side; otherwise every block
+ * is searched for on its own. Either way each arena is locked only once.
+ * Restriction: every size >= 1, as for mymalloc.
+ */
+int mymalloc_batch(const size_t *sizes, int n, void **out)
+{
+	int allocated = 0;
+	int i;
+
+	assert((int)myStrategy > 0);
+
+	for (i = 0; i < n; i++)
+		out[i] = NULL;
+
+	if (threadCaching && myLayout == ListLayout)
+	{
+		for (i = 0; i < n; i++)
+			allocated += (out[i] = cache_malloc(sizes[i])) != NULL;
+		return allocated;
+	}
+
+	size_t total = 0;
+	for (i = 0; i < n; i++)
+		total += align_size(sizes[i]);
+
+	int home = thread_arena();
+	int count = arenaCount;
+	struct arena *target;
+	for (int a = 0; allocated < n && (target = arena_at(home, a, count, total)); a++)
+	{
+		arena_enter(target);
+
+		/* one carve for the whole batch; buddy blocks have to be split by order
+		 * instead, and a bitmap scan for one long run costs more than the
+		 * scans for the short ones */
+		if (myLayout == ListLayout && myStrategy != Buddy && myStrategy != Bitmap && allocated == 0)
+		{
+			struct memoryList *node = total ? allocate_block(total, NULL) : NULL;
+			for (i = 0; node && i < n; i++)
+			{
+				struct memoryList *rest = i < n - 1 ? split_allocated(node, align_size(sizes[i])) : NULL;
+
+				node->requested = sizes[i];
+				arena->wastedBytes += node->size - sizes[i];
+				out[i] = node->ptr;
+				allocated++;
+				node = rest;
+			}
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			if (out[i])
+				continue;
+
+			if (myLayout == TagLayout)
+			{
+				out[i] = tag_memalign(arena->base, myStrategy, minAlign, sizes[i]);
+			}
+			else
+			{
+				struct memoryList *node = allocate_block(sizes[i], NULL);
+				out[i] = node ? node->ptr : NULL;
+			}
+			allocated += out[i] != NULL;
+		}
+		arena_leave();
+	}
+
+	if (allocated < n)
+		fprintf(stderr, "No suitable block found \n");
+
+	return allocated;
+}
+
+/* Split an allocated block after size bytes; the rest becomes an allocated
+ * block of its own, which is returned. Caller holds the arena lock.
+ */
+static struct memoryList *split_allocated(struct memoryList *node, size_t size)
+{
+	struct memoryList *rest = node_alloc();
+
+	rest->next = node->next;
+	rest->next->prev = rest;
+	rest->prev = node;
+	node->next = rest;
+
+	rest->size = node->size - size;
+	rest->ptr = (char *)node->ptr + size;
+	rest->alloc = 1;
+	rest->requested = rest->size;
+	rest->zeroed = 0;
+	rest->handle = 0;
+	rest->quick = 0;
+	rest->owner = NULL;
+	rest->cached = 0;
+	node->size = size;
+
+	index_insert(rest);
+	return rest;
+}
+
+static int compare_pointers(const void *a, const void *b)
+{
+	char *x = *(char *const *)a, *y = *(char *const *)b;
+	return (x > y) - (x < y);
+}
+
+/* Free n blocks at once. ptrs is sorted by address in place, so that the
+ * blocks of each arena are freed under one lock in a single pass from low to
+ * high addresses, and a run of neighbouring blocks is merged into one free
+ * block that is filed in the free lists only once. NULL entries are skipped.
+ */
+void myfree_batch(void **ptrs, int n)
+{
+	int i = 0;
+
+	if (threadCaching && myLayout == ListLayout)
+	{
+		for (i = 0; i < n; i++)
+			if (ptrs[i])
+				myfree(ptrs[i]);
+		return;
+	}
+
+	qsort(ptrs, n, sizeof(ptrs[0]), compare_pointers);
+
+	while (i < n && !ptrs[i])
+		i++;
+
+	while (i < n)
+	{
+		struct arena *owner = arena_of(ptrs[i]);
+		struct memoryList *pending = NULL;
+
+		if (!owner)
+		{
+			fprintf(stderr, "myfree: %p is not an allocated block in this pool\n", ptrs[i++]);
+			continue;
+		}
+
+		arena_enter(owner);
+		for (; i < n && arena_of(ptrs[i]) == owner; i++)
+		{
+			struct memoryList *trav;
+
+			if (myLayout == TagLayout)
+			{
+				if (tag_free(arena->base, ptrs[i]) < 0)
+					fprintf(stderr, "myfree: %p is not an allocated block in this pool\n", ptrs[i]);
+				continue;
+			}
+
+			trav = index_lookup(ptrs[i]);
+			if (!trav || !trav->alloc || trav->cached)
+			{
+				fprintf(stderr, "myfree: %p is not an allocated block in this pool\n", ptrs[i]);
+				continue;
+			}
+
+			if (trav->handle)
+				handle_release(trav->handle);
+
+			if (myStrategy == Buddy)
+			{
+				release_block(trav);
+				continue;
+			}
+
+			// the block just freed stays out of the free lists while the blocks after it join it
+			trav = release_unfiled(trav, pending);
+			if (pending && trav != pending)
+				file_released(pending);
+			pending = trav;
+		}
+
+		if (pending)
+			file_released(pending);
+		arena_leave();
+	}
+}
+
+// Mark an allocated block free, without merging it with anything.
+static void mark_free(struct memoryList *trav)
+{
+	trav->alloc = 0;
+	trav->owner = NULL;
+	trav->cached = 0;
+	trav->zeroed = 0;
+
+	if (arena->freeMap)
+		bitmap_set_range(arena->freeMap, (char *)trav->ptr - (char *)arena->base, trav->size);
+
+	arena->wastedBytes -= trav->size - trav->requested;
+}
+
+/* Mark an allocated block free and merge it with free neighbours. Caller holds the arena lock. */
+static void release_block(struct memoryList *trav)
+{
+	// Buddy blocks only ever merge with their buddy, one order at a time
+	if (myStrategy == Buddy)
+	{
+		struct memoryList *buddy;
+
+		mark_free(trav);
+		while ((buddy = buddy_of(trav)) && !buddy->alloc)
+		{
+			freelist_remove(buddy);
+			// with only two blocks in the arena prev and next are the same node, so compare addresses
+			if (buddy->ptr < trav->ptr)
+			{
+				free_adjacent(trav);
+				trav = buddy;
+			}
+			else
+			{
+				free_adjacent(buddy);
+			}
+		}
+		file_released(trav);
+		return;
+	}
+
+	// lazy coalescing: the block waits unmerged, filed under its own size
+	if (lazyLimit && trav->size <= QUICK_MAX)
+	{
+		mark_free(trav);
+		freelist_insert(trav);
+		quick_push(trav);
+		if (arena->quickBlocks >= lazyLimit)
+			quick_flush();
+		return;
+	}
+
+	// file the (possibly merged) block under its final size
+	file_released(release_unfiled(trav, NULL));
+}
+
+/* File a block that was just freed and merged with its neighbours, and give
+ * its pages back to the OS if it is at least trimThreshold bytes.
+ */
+static void file_released(struct memoryList *node)
+{
+	freelist_insert(node);
+	if (trimThreshold && node->size >= trimThreshold)
+		trim_block(node);
+}
+
+/* Give the whole pages inside a free block back to the OS. The bytes around
+ * them are cleared, so that the block is known to be zero afterwards; a block
+ * that is known to be zero already has nothing left to give back. Returns the
+ * bytes given back. Caller holds the arena lock.
+ */
+static size_t trim_block(struct memoryList *node)
+{
+	char *start = node->ptr;
+	char *end = start + node->size;
+	char *from = (char *)(((size_t)start + pageSize - 1) & ~(pageSize - 1));
+	char *to = (char *)((size_t)end & ~(pageSize - 1));
+
+	if (node->zeroed || from >= to)
+		return 0;
+
+	if (madvise(from, to - from, MADV_DONTNEED))
+		return 0;
+
+	memset(start, 0, from - start);
+	memset(to, 0, end - to);
+	node->zeroed = 1;
+	return to - from;
+}
+
+/* release_block, except that the merged block it returns is not filed in the
+ * free lists yet. pending is a free block that is not filed either (or NULL);
+ * trav merges into it if it is the block in front. Not for Buddy.
+ */
+static struct memoryList *release_unfiled(struct memoryList *trav, struct memoryList *pending)
+{
+	// Mark the block as freed. If no adjacent blocks are also free, then do nothing else.
+	mark_free(trav);
+	return merge_unfiled(trav, pending);
+}
+
+/* Merge a free block that is not filed with its free neighbours, and return
+ * the merged block, which is not filed either. pending is as for release_unfiled.
+ */
+static struct memoryList *merge_unfiled(struct memoryList *trav, struct memoryList *pending)
+{
+	// If the block isnt the head of the list, and the previous node isn't allocated merge into one block.
+	// A block that waited unmerged may border another free block, so keep going while there is one.
+	while ((trav != arena->head) && !(trav->prev->alloc))
+	{
+		// set up helper pointer
+		struct memoryList *previous = trav->prev;
+		if (previous != pending)
+			freelist_remove(previous);
+		if (previous->quick)
+			quick_remove(previous);
+		free_adjacent(trav);
+		// since we are merging the contents of this block into the adjacent block, move the trav pointer space back in the list
+		trav = previous;
+	}
+
+	// likewise for the next block
+	while (trav->next != arena->head && !(trav->next->alloc))
+	{
+		freelist_remove(trav->next);
+		if (trav->next->quick)
+			quick_remove(trav->next);
+		free_adjacent(trav->next);
+	}
+
+	return trav;
+}
+
+static void quick_push(struct memoryList *node)
+{
+	node->quick = 1;
+	node->quickPrev = NULL;
+	node->quickNext = arena->quickLists[node->size];
+	if (node->quickNext)
+		node->quickNext->quickPrev = node;
+	arena->quickLists[node->size] = node;
+	arena->quickBlocks++;
+}
+
+static void quick_remove(struct memoryList *node)
+{
+	if (node->quickPrev)
+		node->quickPrev->quickNext = node->quickNext;
+	else
+		arena->quickLists[node->size] = node->quickNext;
+	if (node->quickNext)
+		node->quickNext->quickPrev = node->quickPrev;
+	node->quick = 0;
+	arena->quickBlocks--;
+}
+
+/* A block that comes off a quick list was never merged, so it may border
+ * free blocks. Merge them into the free block node, which is filed.
+ */
+static void merge_next(struct memoryList *node)
+{
+	if (node->next == arena->head || node->next->alloc)
+		return;
+
+	freelist_remove(node);
+	while (node->next != arena->head && !node->next->alloc)
+	{
+		freelist_remove(node->next);
+		if (node->next->quick)
+			quick_remove(node->next);
+		free_adjacent(node->next);
+	}
+	freelist_insert(node);
+}
+
+// Merge every block waiting on a quick list with its free neighbours. Caller holds the arena lock.
+static void quick_flush()
+{
+	for (int size = 0; size <= QUICK_MAX && arena->quickBlocks; size++)
+	{
+		// merging may take other waiting blocks off their lists, so always start from the head
+		while (arena->quickLists[size])
+		{
+			struct memoryList *node = arena->quickLists[size];
+			quick_remove(node);
+			freelist_remove(node);
+			freelist_insert(merge_unfiled(node, NULL));
+		}
+	}
+}
+
+/* Resize an allocated block, keeping its contents up to the smaller size.
+ * Where possible the block stays put: shrinking splits off a free tail, and
+ * growing absorbs a free next block. Otherwise the data moves to a new block.
+ * myrealloc(NULL, n) is mymalloc(n), and myrealloc(block, 0) frees the block.
+ * Returns NULL, leaving the block as it was, if no block is large enough.
+ */
+void *myrealloc(void *block, size_t newsize)
+{
+	size_t oldsize = 0;
+	int resized = -1;
+	mem_handle handle = 0;
+
+	if (!block)
+		return mymalloc(newsize);
+
+	if (newsize == 0)
+	{
+		myfree(block);
+		return NULL;
+	}
+
+	if (arena_of(block))
+	{
+		arena_enter(arena_of(block));
+		if (myLayout == TagLayout)
+		{
+			resized = tag_resize(arena->base, block, newsize, &oldsize);
+		}
+		else
+		{
+			struct memoryList *node = index_lookup(block);
+			if (node && node->alloc && !node->cached)
+			{
+				handle = node->handle;
+				oldsize = node->size;
+				resized = resize_block(node, newsize);
+			}
+		}
+		arena_leave();
+	}
+
+	if (resized < 0)
+	{
+		fprintf(stderr, "myrealloc: %p is not an allocated block in this pool\n", block);
+		return NULL;
+	}
+	if (resized)
+		return block;
+
+	// a copy would not be reachable through the handle
+	if (handle)
+		return NULL;
+
+	// no room where it is: allocate, copy and free
+	void *moved = mymalloc(newsize);
+	if (!moved)
+		return NULL;
+
+	memcpy(moved, block, oldsize < newsize ? oldsize : newsize);
+	myfree(block);
+	return moved;
+}
+
+/* Resize an allocated block without moving it. Returns 1 on success, 0 if it
+ * cannot grow where it is. Caller holds the arena lock.
+ */
+static int resize_block(struct memoryList *node, size_t newsize)
+{
+	struct memoryList *next = node->next;
+	size_t offset = (char *)node->ptr - (char *)arena->base;
+
+	// a buddy block keeps its order, so only a size within the order fits
+	if (myStrategy == Buddy)
+	{
+		if (newsize > node->size || newsize <= node->size / 2)
+			return 0;
+
+		arena->wastedBytes = arena->wastedBytes + node->requested - newsize;
+		node->requested = newsize;
+		return 1;
+	}
+
+	size_t requested = newsize;
+	size_t waste = node->size - node->requested;
+	newsize = align_size(newsize);
+
+	if (newsize < node->size)
+	{
+		size_t tail = node->size - newsize;
+
+		if (arena->freeMap)
+			bitmap_set_range(arena->freeMap, offset + newsize, tail);
+
+		// the tail joins a free next block, or becomes a free block of its own
+		if (next != arena->head && !next->alloc)
+		{
+			char wasQuick = next->quick;
+			freelist_remove(next);
+			if (wasQuick)
+				quick_remove(next);
+			index_remove(next);
+			next->ptr = (char *)next->ptr - tail;
+			next->size += tail;
+			next->zeroed = 0;
+			node->size = newsize;
+			index_insert(next);
+			freelist_insert(next);
+			if (wasQuick)
+				merge_next(next);
+		}
+		else
+		{
+			insertBlock(node, newsize);
+		}
+	}
+	else if (newsize > node->size)
+	{
+		size_t needed = newsize - node->size;
+
+		if (next == arena->head || next->alloc || next->size < needed)
+			return 0;
+
+		if (arena->freeMap)
+			bitmap_clear_range(arena->freeMap, offset + node->size, needed);
+
+		// take the front of the next block, or all of it
+		char wasQuick = next->quick;
+		freelist_remove(next);
+		if (wasQuick)
+			quick_remove(next);
+		if (next->size == needed)
+		{
+			free_adjacent(next);
+		}
+		else
+		{
+			index_remove(next);
+			next->ptr = (char *)next->ptr + needed;
+			next->size -= needed;
+			node->size = newsize;
+			index_insert(next);
+			freelist_insert(next);
+			if (wasQuick)
+				merge_next(next);
+		}
+	}
+
+	node->requested = requested;
+	arena->wastedBytes = arena->wastedBytes - waste + node->size - requested;
+	return 1;
+}
+
+static struct handleSlot *handle_slot(mem_handle handle)
+{
+	return &handlePages[handle / HANDLE_PAGE][handle % HANDLE_PAGE];
+}
+
+// Give an allocated block a handle, or return 0 if the table is full. Caller holds the arena lock.
+static mem_handle handle_assign(struct memoryList *node)
+{
+	mem_handle handle = 0;
+
+	pthread_mutex_lock(&handleLock);
+	if (handleFree)
+	{
+		handle = handleFree;
+		handleFree = handle_slot(handle)->nextFree;
+	}
+	else if (handleSlots + 1 < HANDLE_PAGE * HANDLE_PAGES)
+	{
+		handle = ++handleSlots;
+		if (!handlePages[handle / HANDLE_PAGE])
+			handlePages[handle / HANDLE_PAGE] = calloc(HANDLE_PAGE, sizeof(struct handleSlot));
+	}
+
+	if (handle)
+	{
+		handle_slot(handle)->ptr = node->ptr;
+		node->handle = handle;
+		handlesInUse++;
+	}
+	pthread_mutex_unlock(&handleLock);
+	return handle;
+}
+
+static void handle_release(mem_handle handle)
+{
+	pthread_mutex_lock(&handleLock);
+	handle_slot(handle)->ptr = NULL;
+	handle_slot(handle)->nextFree = handleFree;
+	handleFree = handle;
+	handlesInUse--;
+	pthread_mutex_unlock(&handleLock);
+}
+
+/* Allocate a movable block and return its handle, or 0 if no block is large
+ * enough even after compacting. mem_compact may move the block, so look its
+ * address up with mem_deref after every compaction, and after every mymalloc,
+ * which compacts when it runs out of room. myrealloc only resizes a movable
+ * block where it is. List layout only.
+ */
+mem_handle mymalloc_handle(size_t requested)
+{
+	mem_handle handle = 0;
+
+	assert((int)myStrategy > 0);
+
+	if (myLayout == TagLayout)
+	{
+		fprintf(stderr, "mymalloc_handle: movable blocks need the list layout\n");
+		return 0;
+	}
+
+	for (int attempt = 0; attempt < 2 && !handle; attempt++)
+	{
+		if (attempt)
+			mem_compact();
+
+		int home = thread_arena();
+		int count = arenaCount;
+		struct arena *target;
+		for (int i = 0; !handle && (target = arena_at(home, i, count, requested)); i++)
+		{
+			arena_enter(target);
+			struct memoryList *node = allocate_block(requested, NULL);
+			if (node)
+			{
+				handle = handle_assign(node);
+				if (!handle)
+					release_block(node);
+			}
+			arena_leave();
+		}
+	}
+
+	if (!handle)
+		fprintf(stderr, "No suitable block found \n");
+
+	return handle;
+}
+
+// Current address of a movable block, or NULL if handle is not in use.
+void *mem_deref(mem_handle handle)
+{
+	if (handle <= 0 || handle > handleSlots)
+		return NULL;
+
+	return handle_slot(handle)->ptr;
+}
+
+void myfree_handle(mem_handle handle)
+{
+	void *block = mem_deref(handle);
+
+	if (!block)
+	{
+		fprintf(stderr, "myfree_handle: %d is not a handle in use\n", handle);
+		return;
+	}
+
+	// the block may move until its arena is locked, but never to another arena
+	arena_enter(arena_of(block));
+	block = mem_deref(handle);
+	if (block)
+	{
+		struct memoryList *node = index_lookup(block);
+		handle_release(handle);
+		release_block(node);
+	}
+	arena_leave();
+}
+
+/* Move the movable block that follows a free block to the start of the free
+ * block, so that the free space moves up behind it and joins any free block
+ * there. Caller holds the arena lock.
+ */
+static void slide_down(struct memoryList *hole, struct memoryList *block)
+{
+	size_t offset = (char *)hole->ptr - (char *)arena->base;
+
+	freelist_remove(hole);
+	index_remove(hole);
+	index_remove(block);
+
+	memmove(hole->ptr, block->ptr, block->size);
+	block->ptr = hole->ptr;
+	hole->ptr = (char *)block->ptr + block->size;
+	hole->zeroed = 0;
+
+	// swap the two nodes; with only the two of them in the arena the list is already right
+	if (block->next != hole)
+	{
+		hole->prev->next = block;
+		block->prev = hole->prev;
+		hole->next = block->next;
+		block->next->prev = hole;
+		block->next = hole;
+		hole->prev = block;
+	}
+	if (arena->head == hole)
+		arena->head = block;
+
+	index_insert(block);
+	index_insert(hole);
+
+	pthread_mutex_lock(&handleLock);
+	handle_slot(block->handle)->ptr = block->ptr;
+	pthread_mutex_unlock(&handleLock);
+
+	if (arena->freeMap)
+	{
+		bitmap_clear_range(arena->freeMap, offset, block->size);
+		bitmap_set_range(arena->freeMap, offset + block->size, hole->size);
+	}
+
+	if (hole->next != arena->head && !hole->next->alloc)
+	{
+		freelist_remove(hole->next);
+		free_adjacent(hole->next);
+	}
+	freelist_insert(hole);
+}
+
+/* Slide the movable blocks of the locked arena down over the free blocks in
+ * front of them. Blocks without a handle stay put, and so does the free
+ * space behind them until a movable block comes along. Stops once deadline
+ * (if any) has passed, after at least one move. Returns 1 when nothing is
+ * left to move.
+ */
+static int compact_arena(const struct timespec *deadline)
+{
+	struct memoryList *hole = arena->head;
+	struct timespec now;
+
+	// buddy blocks have to stay where their buddies can find them
+	if (myStrategy == Buddy)
+		return 1;
+
+	// a hole is followed by an allocated block only once everything is merged
+	quick_flush();
+
+	while (hole->next != arena->head)
+	{
+		struct memoryList *block = hole->next;
+
+		if (hole->alloc || !block->alloc || !block->handle)
+		{
+			hole = block;
+			continue;
+		}
+
+		slide_down(hole, block);
+
+		if (deadline)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/* Move every movable block as far down its arena as it goes, so that the free
+ * space between them becomes one hole. Addresses from mem_deref are stale
+ * afterwards. Does nothing with TagLayout or Buddy.
+ */
+void mem_compact()
+{
+	if (myLayout == TagLayout)
+		return;
+
+	for (int i = 0; i < arenaCount; i++)
+	{
+		arena_enter(&arenas[i]);
+		compact_arena(NULL);
+		arena_leave();
+	}
+}
+
+/* Incremental mem_compact: compact for about budget_us microseconds, moving
+ * at least one block if any can move. Returns 1 when the pool is compact,
+ * 0 if another step is needed.
+ */
+int mem_compact_step(long budget_us)
+{
+	struct timespec deadline;
+	int compact = 1;
+
+	if (myLayout == TagLayout)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += budget_us / 1000000;
+	deadline.tv_nsec += budget_us % 1000000 * 1000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	for (int i = 0; i < arenaCount && compact; i++)
+	{
+		arena_enter(&arenas[i]);
+		compact = compact_arena(&deadline);
+		arena_leave();
+	}
+	return compact;
+}
+
+static void cache_destroy(void *arg);
+
+static void cache_key_create()
+{
+	pthread_key_create(&cacheKey, cache_destroy);
+}
+
+// The calling thread's cache, created on first use and emptied when the pool was re-initialised.
+static struct threadCache *thread_cache()
+{
+	struct threadCache *cache = myCache;
+
+	if (!cache)
+	{
+		pthread_once(&cacheKeyOnce, cache_key_create);
+		cache = calloc(1, sizeof(struct threadCache));
+		table_init(&cache->owned);
+		cache->generation = poolGeneration;
+		pthread_setspecific(cacheKey, cache);
+		myCache = cache;
+	}
+
+	if (cache->generation != poolGeneration)
+	{
+		// the old blocks went away with the old pool
+		memset(cache->bins, 0, sizeof(cache->bins));
+		memset(cache->binCounts, 0, sizeof(cache->binCounts));
+		table_free(&cache->owned);
+		table_init(&cache->owned);
+		atomic_store(&cache->remoteFrees, NULL);
+		cache->generation = poolGeneration;
+	}
+
+	return cache;
+}
+
+/* Return cached blocks of one bin to the pool until at most keep are left.
+ * The arena lock is only switched when consecutive blocks live in different arenas.
+ */
+static void cache_flush_bin(struct threadCache *cache, int bin, int keep)
+{
+	struct arena *locked = NULL;
+
+	while (cache->binCounts[bin] > keep)
+	{
+		struct memoryList *node = cache->bins[bin];
+		cache->bins[bin] = node->nextFree;
+		cache->binCounts[bin]--;
+
+		if (arena_of(node->ptr) != locked)
+		{
+			if (locked)
+				arena_leave();
+			locked = arena_enter(arena_of(node->ptr));
+		}
+
+		table_remove(&cache->owned, node);
+		release_block(node);
+	}
+
+	if (locked)
+		arena_leave();
+}
+
+static void cache_push(struct threadCache *cache, struct memoryList *node)
+{
+	int bin = bin_index(node->size);
+
+	if (cache->binCounts[bin] >= CACHE_BIN_LIMIT)
+		cache_flush_bin(cache, bin, CACHE_BIN_LIMIT / 2);
+
+	node->cached = 1;
+	node->nextFree = cache->bins[bin];
+	cache->bins[bin] = node;
+	cache->binCounts[bin]++;
+}
+
+// Take back the blocks other threads freed on our behalf.
+static void cache_drain_remote(struct threadCache *cache)
+{
+	if (!atomic_load_explicit(&cache->remoteFrees, memory_order_relaxed))
+		return;
+
+	struct memoryList *node = atomic_exchange(&cache->remoteFrees, NULL);
+	while (node)
+	{
+		struct memoryList *next = node->remoteNext;
+		cache_push(cache, node);
+		node = next;
+	}
+}
+
+// Register a lookup without the arena lock, see remoteLookups. Returns the epoch to leave.
+static int remote_enter()
+{
+	for (;;)
+	{
+		int epoch = atomic_load(&remoteEpoch);
+		atomic_fetch_add(&remoteLookups[epoch], 1);
+
+		// a lookup counts under the epoch it saw after registering, or an exiting thread could miss it
+		if (atomic_load(&remoteEpoch) == epoch)
+			return epoch;
+		atomic_fetch_sub(&remoteLookups[epoch], 1);
+	}
+}
+
+static void remote_leave(int epoch)
+{
+	atomic_fetch_sub(&remoteLookups[epoch], 1);
+}
+
+// Wait for every lookup that may have started before the call to finish.
+static void remote_wait()
+{
+	pthread_mutex_lock(&epochLock);
+	int epoch = atomic_load(&remoteEpoch);
+	atomic_store(&remoteEpoch, !epoch);
+	while (atomic_load(&remoteLookups[epoch]))
+		sched_yield();
+	pthread_mutex_unlock(&epochLock);
+}
+
+/* Hand a block another thread holds back to it through its lock-free queue.
+ * Returns 0 if the block has no owner (any more), and the caller frees it as
+ * usual. Registering the lookup keeps the owner's cache from being freed
+ * before the push is done.
+ */
+static int cache_push_remote(struct memoryList *node)
+{
+	int epoch = remote_enter();
+	struct threadCache *owner = atomic_load(&node->owner);
+	char cached = 0;
+
+	if (owner)
+	{
+		// claiming the block also catches a second free racing with this one
+		if (__atomic_compare_exchange_n(&node->cached, &cached, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		{
+			node->remoteNext = atomic_load(&owner->remoteFrees);
+			while (!atomic_compare_exchange_weak(&owner->remoteFrees, &node->remoteNext, node))
+				;
+		}
+		else
+		{
+			fprintf(stderr, "myfree: %p is not an allocated block in this pool\n", node->ptr);
+		}
+	}
+
+	remote_leave(epoch);
+	return owner != NULL;
+}
+
+/* Free a block another thread holds without taking its arena's lock. Returns
+ * 0 if it is not such a block, or could not be found while the index was
+ * changing; the caller then frees it under the lock.
+ */
+static int cache_free_remote(void *block, const size_t *hint)
+{
+	struct arena *owner = arena_of(block);
+	struct memoryList *node;
+	int freed = 0;
+
+	if (!owner)
+		return 0;
+
+	int epoch = remote_enter();
+	node = table_peek(&owner->addrIndex, block);
+	if (node && __atomic_load_n(&node->alloc, __ATOMIC_RELAXED))
+	{
+		// a held block fits any size hint up to its size; one that does not stays allocated
+		if (hint && atomic_load(&node->owner) && !__atomic_load_n(&node->cached, __ATOMIC_RELAXED) && !size_fits(block, *hint, 0, node->size))
+			freed = 1;
+		else
+			freed = cache_push_remote(node);
+	}
+	remote_leave(epoch);
+	return freed;
+}
+
+// Allocate a list block from the thread's own arena, from any other one when it is full, or from a new segment.
+static struct memoryList *allocate_any(size_t requested)
+{
+	struct memoryList *node = NULL;
+	int home = thread_arena();
+	int count = arenaCount;
+	struct arena *target;
+
+	for (int i = 0; !node && (target = arena_at(home, i, count, requested)); i++)
+	{
+		arena_enter(target);
+		node = allocate_block(requested, NULL);
+		arena_leave();
+	}
+	return node;
+}
+
+static void *cache_malloc(size_t requested)
+{
+	struct threadCache *cache = thread_cache();
+	struct memoryList *node;
+	int bin = bin_index(requested);
+
+	cache_drain_remote(cache);
+
+	// a cached block of the same size class that is large enough
+	for (struct memoryList **link = &cache->bins[bin]; *link; link = &(*link)->nextFree)
+	{
+		if ((*link)->size >= requested)
+		{
+			node = *link;
+			*link = node->nextFree;
+			cache->binCounts[bin]--;
+			node->cached = 0;
+			return node->ptr;
+		}
+	}
+
+	node = allocate_any(requested);
+
+	// memory parked in the cache must not make the allocation fail
+	if (!node)
+	{
+		mem_flush_thread_cache();
+		node = allocate_any(requested);
+	}
+
+	if (!node)
+	{
+		fprintf(stderr, "No suitable block found \n");
+		return NULL;
+	}
+
+	node->owner = cache;
+	table_insert(&cache->owned, node);
+	return node->ptr;
+}
+
+// Free a block this thread holds into its cache. Returns 0 if the block is not ours.
+static int cache_free(void *block, const size_t *hint)
+{
+	struct threadCache *cache = thread_cache();
+	struct memoryList *node = table_lookup(&cache->owned, block);
+
+	if (!node)
+		return 0;
+
+	// a size hint that does not fit leaves the block allocated
+	if (hint && !__atomic_load_n(&node->cached, __ATOMIC_RELAXED) && !size_fits(block, *hint, 0, node->size))
+		return 1;
+
+	// other threads may be claiming the block at the same time, see cache_push_remote
+	if (__atomic_exchange_n(&node->cached, 1, __ATOMIC_ACQ_REL))
+	{
+		fprintf(stderr, "myfree: %p is not an allocated block in this pool\n", block);
+		return 1;
+	}
+
+	cache_drain_remote(cache);
+	cache_push(cache, node);
+	return 1;
+}
+
+/* Return every block cached by the calling thread to the pool. */
+void mem_flush_thread_cache()
+{
+	if (!threadCaching || myLayout != ListLayout)
+		return;
+
+	struct threadCache *cache = thread_cache();
+
+	cache_drain_remote(cache);
+	for (int bin = 0; bin < BIN_COUNT; bin++)
+	{
+		if (cache->binCounts[bin])
+			cache_flush_bin(cache, bin, 0);
+	}
+}
+
+// Thread exit: give the cached blocks back and disown the ones still in use.
+static void cache_destroy(void *arg)
+{
+	struct threadCache *cache = arg;
+
+	if (cache->generation == poolGeneration)
+	{
+		struct memoryList *node;
+
+		/* Blocks in use go on without an owner, and out of the table, as other
+		 * threads may free them from now on. Once the remote frees that saw us
+		 * as the owner are done, our queue is final.
+		 */
+		table_settle(&cache->owned);
+		for (size_t slot = 0; slot < cache->owned.capacity;)
+		{
+			node = cache->owned.slots[slot];
+			if (node && !__atomic_load_n(&node->cached, __ATOMIC_ACQUIRE))
+			{
+				// the node is not ours to look at once it is disowned
+				table_remove(&cache->owned, node); // may shift another entry into this slot
+				atomic_store(&node->owner, NULL);
+				continue;
+			}
+			slot++;
+		}
+		remote_wait();
+
+		// a segment added meanwhile holds none of our blocks
+		int count = arenaCount;
+		for (int i = 0; i < count; i++)
+			pthread_mutex_lock(&arenas[i].lock);
+
+		node = atomic_exchange(&cache->remoteFrees, NULL);
+		while (node)
+		{
+			struct memoryList *next = node->remoteNext;
+
+			// a block freed just as we disowned it has left the table already
+			if (table_lookup(&cache->owned, node->ptr) == node)
+				table_remove(&cache->owned, node);
+			arena = arena_of(node->ptr);
+			release_block(node);
+			node = next;
+		}
+
+		for (size_t slot = 0; slot < cache->owned.capacity; slot++)
+		{
+			node = cache->owned.slots[slot];
+			if (node && node->cached)
+			{
+				arena = arena_of(node->ptr);
+				release_block(node);
+			}
+		}
+
+		for (int i = 0; i < count; i++)
+			pthread_mutex_unlock(&arenas[i].lock);
+		arena = NULL;
+	}
+
+	table_free(&cache->owned);
+	free(cache);
+	myCache = NULL;
+}
+
+void *free_adjacent(struct memoryList *blockToMerge)
+{
+
+	// Merge the matching blocks memory into the previous block
+	blockToMerge->prev->size += blockToMerge->size;
+	blockToMerge->prev->zeroed &= blockToMerge->zeroed;
+
+	// Setup the new connection after removal from the list
+	blockToMerge->prev->next = blockToMerge->next;
+	blockToMerge->next->prev = blockToMerge->prev;
+
+	// If our currentnode is pointing to the block to be freed, make sure currentnode doesnt point to a freed node.
+	if (arena->currentnode == blockToMerge)
+	{
+		arena->currentnode = arena->currentnode->prev;
+	}
+
+	// free the node
+	index_remove(blockToMerge);
+	node_release(blockToMerge);
+}
+
+void insertBlock(struct memoryList *node, size_t requested)
+{
+	// Create a new node, this node is to be set adjacent to the matched node (current node)
+	struct memoryList *newnode = node_alloc();
+
+	// Setting up connection for the new node
+	newnode->next = node->next;
+	newnode->next->prev = newnode;
+	newnode->prev = node;
+	node->next = newnode;
+
+	// set the values for the newnode
+	// The size of the new (free) node will be whatever is remaining of the matched node after subtracting the requested memory space
+	newnode->size = node->size - requested;
+	newnode->ptr = node->ptr + requested;
+	newnode->alloc = 0;
+	newnode->zeroed = node->zeroed;
+	newnode->handle = 0;
+	newnode->quick = 0;
+
+	// set the matched node to be equal the size of the request
+	node->size = requested;
+
+	// Make sure we start from this point when inserting new node
+	arena->currentnode = newnode;
+
+	index_insert(newnode);
+	freelist_insert(newnode);
+}
+
+static struct memoryList *node_alloc()
+{
+	struct memoryList *node = arena->freeNodes;
+
+	// reuse a released node if there is one
+	if (node)
+	{
+		arena->freeNodes = node->next;
+		return node;
+	}
+
+	if (arena->chunkNodesUsed == arena->chunkNodes && !node_reserve(CHUNK_NODES))
+		return NULL;
+
+	return &arena->nodeChunks->nodes[arena->chunkNodesUsed++];
+}
+
+// Start a new chunk of count nodes for node_alloc to carve. Returns 0 if libc has no memory.
+static int node_reserve(size_t count)
+{
+	struct nodeChunk *chunk;
+
+	if (posix_memalign((void **)&chunk, CACHE_LINE, CACHE_LINE + count * sizeof(struct memoryList)))
+		return 0;
+
+	chunk->nodes = (struct memoryList *)((char *)chunk + CACHE_LINE);
+	chunk->next = arena->nodeChunks;
+	arena->nodeChunks = chunk;
+	arena->chunkNodes = count;
+	arena->chunkNodesUsed = 0;
+	return 1;
+}
+
+static void node_release(struct memoryList *node)
+{
+	node->next = arena->freeNodes;
+	arena->freeNodes = node;
+}
+
+/* Map a block size to its size-class bin. Bins grow monotonically with size;
+ * sizes below BIN_SUBCLASSES get a bin each.
+ */
+static int bin_index(size_t size)
+{
+	if (size < BIN_SUBCLASSES)
+		return size;
+
+	int log = 63 - __builtin_clzll(size);
+	int sub = (size >> (log - BIN_SUBCLASS_LOG)) & (BIN_SUBCLASSES - 1);
+	return (log - BIN_SUBCLASS_LOG + 1) * BIN_SUBCLASSES + sub;
+}
+
+// Find the first non-empty bin at or above bin, or -1 if there is none.
+static int bin_next_nonempty(int bin)
+{
+	if (bin >= BIN_COUNT)
+		return -1;
+
+	int word = bin / 64;
+	unsigned long long bits = arena->binMap[word] & (~0ull << (bin % 64));
+
+	while (!bits)
+	{
+		if (++word == BIN_MAP_WORDS)
+			return -1;
+		bits = arena->binMap[word];
+	}
+	return word * 64 + __builtin_ctzll(bits);
+}
+
+// The non-empty bins of one power of two, as BIN_SUBCLASSES bits: the TLSF second level.
+static unsigned int group_bins(int group)
+{
+	int bin = group * BIN_SUBCLASSES;
+	return (arena->binMap[bin / 64] >> (bin % 64)) & ((1u << BIN_SUBCLASSES) - 1);
+}
+
+// Strict (size, ptr) ordering used by the treap
+static int tree_less(struct memoryList *a, struct memoryList *b)
+{
+	return a->size < b->size || (a->size == b->size && a->ptr < b->ptr);
+}
+
+static int tree_count(struct memoryList *root)
+{
+	return root ? root->treeCount : 0;
+}
+
+// Recompute the subtree count after the children of root changed.
+static struct memoryList *tree_update(struct memoryList *root)
+{
+	root->treeCount = 1 + tree_count(root->treeLeft) + tree_count(root->treeRight);
+	return root;
+}
+
+// Split the treap into the blocks ordered before key and the rest.
+static void tree_split(struct memoryList *root, struct memoryList *key, struct memoryList **left, struct memoryList **right)
+{
+	if (!root)
+	{
+		*left = *right = NULL;
+	}
+	else if (tree_less(root, key))
+	{
+		tree_split(root->treeRight, key, &root->treeRight, right);
+		*left = tree_update(root);
+	}
+	else
+	{
+		tree_split(root->treeLeft, key, left, &root->treeLeft);
+		*right = tree_update(root);
+	}
+}
+
+// Join two treaps where every block in left is ordered before every block in right.
+static struct memoryList *tree_merge(struct memoryList *left, struct memoryList *right)
+{
+	if (!left)
+		return right;
+	if (!right)
+		return left;
+
+	if (left->treePriority > right->treePriority)
+	{
+		left->treeRight = tree_merge(left->treeRight, right);
+		return tree_update(left);
+	}
+	right->treeLeft = tree_merge(left, right->treeLeft);
+	return tree_update(right);
+}
+
+static struct memoryList *tree_insert(struct memoryList *root, struct memoryList *node)
+{
+	if (!root)
+		return node;
+
+	// the new node becomes the root of this subtree once its priority wins
+	if (node->treePriority > root->treePriority)
+	{
+		tree_split(root, node, &node->treeLeft, &node->treeRight);
+		return tree_update(node);
+	}
+
+	if (tree_less(node, root))
+		root->treeLeft = tree_insert(root->treeLeft, node);
+	else
+		root->treeRight = tree_insert(root->treeRight, node);
+	return tree_update(root);
+}
+
+static struct memoryList *tree_remove(struct memoryList *root, struct memoryList *node)
+{
+	if (root == node)
+		return tree_merge(node->treeLeft, node->treeRight);
+
+	if (tree_less(node, root))
+		root->treeLeft = tree_remove(root->treeLeft, node);
+	else
+		root->treeRight = tree_remove(root->treeRight, node);
+	return tree_update(root);
+}
+
+// Smallest free block of at least requested bytes; ties go to the lowest address.
+static struct memoryList *tree_lower_bound(size_t requested)
+{
+	struct memoryList *found = NULL;
+	struct memoryList *trav = arena->freeTree;
+
+	while (trav)
+	{
+		if (trav->size >= requested)
+		{
+			found = trav;
+			trav = trav->treeLeft;
+		}
+		else
+		{
+			trav = trav->treeRight;
+		}
+	}
+	return found;
+}
+
+// Largest free block; ties go to the lowest address, like a forward scan of the list.
+static struct memoryList *tree_largest()
+{
+	struct memoryList *trav = arena->freeTree;
+
+	if (!trav)
+		return NULL;
+
+	while (trav->treeRight)
+		trav = trav->treeRight;
+
+	return tree_lower_bound(trav->size);
+}
+
+/* Size trie (TLSF only): a treap is only balanced in expectation, so TLSF
+ * files its free blocks in a binary digital trie on the key (size, offset)
+ * instead, through the treap's fields. Every block is a node, and the blocks
+ * below a node at depth d share the first d bits of its key, so insert,
+ * remove and both statistics queries take at most one step per key bit.
+ */
+static int trie_bits()
+{
+	// sizes and offsets are both below the arena size, so each fits in this many bits
+	return 64 - __builtin_clzll(arena->size);
+}
+
+static unsigned long long trie_key(struct memoryList *node)
+{
+	return (unsigned long long)node->size << trie_bits() | (size_t)((char *)node->ptr - (char *)arena->base);
+}
+
+static void trie_insert(struct memoryList *node)
+{
+	unsigned long long key = trie_key(node);
+	struct memoryList **link = &arena->freeTree;
+	int bit = 2 * trie_bits();
+
+	while (*link)
+	{
+		(*link)->treeCount++;
+		bit--;
+		link = key >> bit & 1 ? &(*link)->treeRight : &(*link)->treeLeft;
+	}
+	node->treeLeft = node->treeRight = NULL;
+	node->treeCount = 1;
+	*link = node;
+}
+
+static void trie_remove(struct memoryList *node)
+{
+	unsigned long long key = trie_key(node);
+	struct memoryList **link = &arena->freeTree;
+	int bit = 2 * trie_bits();
+
+	while (*link != node)
+	{
+		(*link)->treeCount--;
+		bit--;
+		link = key >> bit & 1 ? &(*link)->treeRight : &(*link)->treeLeft;
+	}
+
+	// any leaf below the node shares its key prefix, so it can take the node's place
+	struct memoryList *leaf = node;
+	struct memoryList **leafLink = link;
+	while (leaf->treeLeft || leaf->treeRight)
+	{
+		leaf->treeCount--;
+		leafLink = leaf->treeRight ? &leaf->treeRight : &leaf->treeLeft;
+		leaf = *leafLink;
+	}
+	*leafLink = NULL;
+
+	if (leaf != node)
+	{
+		leaf->treeLeft = node->treeLeft;
+		leaf->treeRight = node->treeRight;
+		leaf->treeCount = node->treeCount;
+		*link = leaf;
+	}
+}
+
+static void freelist_insert(struct memoryList *node)
+{
+	int bin = bin_index(node->size);
+
+	// TLSF keeps to bounded bookkeeping, so its blocks go in the size trie
+	if (myStrategy == TLSF)
+	{
+		trie_insert(node);
+	}
+	else
+	{
+		// xorshift32 priorities keep the treap balanced in expectation
+		arena->treeSeed ^= arena->treeSeed << 13;
+		arena->treeSeed ^= arena->treeSeed >> 17;
+		arena->treeSeed ^= arena->treeSeed << 5;
+		node->treePriority = arena->treeSeed;
+		node->treeLeft = node->treeRight = NULL;
+		node->treeCount = 1;
+		arena->freeTree = tree_insert(arena->freeTree, node);
+	}
+
+	node->prevFree = NULL;
+	node->nextFree = arena->freeBins[bin];
+	if (arena->freeBins[bin])
+		arena->freeBins[bin]->prevFree = node;
+	arena->freeBins[bin] = node;
+	arena->binMap[bin / 64] |= 1ull << (bin % 64);
+	arena->groupMap |= 1ull << (bin / BIN_SUBCLASSES);
+	arena->binCounts[bin]++;
+
+	arena->freeBytes += node->size;
+	arena->freeBlocks++;
+
+	size_t page = ((char *)node->ptr - (char *)arena->base) / PAGE_MAP_UNIT;
+	if (arena->pageFreeStarts[page]++ == 0)
+		radix_set(&arena->freePages, page);
+}
+
+static void freelist_remove(struct memoryList *node)
+{
+	int bin = bin_index(node->size);
+
+	if (myStrategy == TLSF)
+		trie_remove(node);
+	else
+		arena->freeTree = tree_remove(arena->freeTree, node);
+
+	if (node->prevFree)
+		node->prevFree->nextFree = node->nextFree;
+	else
+		arena->freeBins[bin] = node->nextFree;
+
+	if (node->nextFree)
+		node->nextFree->prevFree = node->prevFree;
+
+	if (!arena->freeBins[bin])
+	{
+		arena->binMap[bin / 64] &= ~(1ull << (bin % 64));
+		if (!group_bins(bin / BIN_SUBCLASSES))
+			arena->groupMap &= ~(1ull << (bin / BIN_SUBCLASSES));
+	}
+	arena->binCounts[bin]--;
+
+	arena->freeBytes -= node->size;
+	arena->freeBlocks--;
+
+	size_t page = ((char *)node->ptr - (char *)arena->base) / PAGE_MAP_UNIT;
+	if (--arena->pageFreeStarts[page] == 0)
+		radix_clear(&arena->freePages, page);
+}
+
+/* Hash a block address into a table of capacity slots. Blocks are identified
+ * by their offset into the pool, spread over the table with Fibonacci hashing.
+ */
+static size_t table_slot(size_t capacity, void *ptr)
+{
+	size_t offset = (size_t)((char *)ptr - (char *)myMemory);
+	return (offset * 11400714819323198485ull) & (capacity - 1);
+}
+
+// Slot holding ptr in one table, or capacity if it is not there.
+static size_t probe_find(struct memoryList **slots, size_t capacity, void *ptr)
+{
+	size_t slot = table_slot(capacity, ptr);
+	while (slots[slot])
+	{
+		if (slots[slot]->ptr == ptr)
+			return slot;
+		slot = (slot + 1) & (capacity - 1);
+	}
+	return capacity;
+}
+
+// Slots are written atomically, since table_peek reads them without the lock.
+static void probe_insert(struct memoryList **slots, size_t capacity, struct memoryList *node)
+{
+	size_t slot = table_slot(capacity, node->ptr);
+	while (slots[slot])
+		slot = (slot + 1) & (capacity - 1);
+	__atomic_store_n(&slots[slot], node, __ATOMIC_RELEASE);
+}
+
+static void probe_remove(struct memoryList **slots, size_t capacity, size_t slot)
+{
+	size_t mask = capacity - 1;
+
+	// Backward-shift deletion: pull later entries of the same probe run into the gap,
+	// so lookups never stop early on an empty slot and no tombstones are needed.
+	size_t gap = slot;
+	for (size_t next = (gap + 1) & mask; slots[next]; next = (next + 1) & mask)
+	{
+		size_t home = table_slot(capacity, slots[next]->ptr);
+		// the entry may move into the gap only if its home slot is not between gap and next (cyclically)
+		if (((next - home) & mask) >= ((next - gap) & mask))
+		{
+			__atomic_store_n(&slots[gap], slots[next], __ATOMIC_RELEASE);
+			gap = next;
+		}
+	}
+	__atomic_store_n(&slots[gap], NULL, __ATOMIC_RELEASE);
+}
+
+/* probe_find for table_peek: bounded by the capacity, as the slots may change
+ * underneath, and so may a node being reused meanwhile; the caller checks the
+ * node it gets.
+ */
+static struct memoryList *probe_peek(struct memoryList **slots, size_t capacity, void *ptr)
+{
+	size_t slot = table_slot(capacity, ptr);
+	struct memoryList *node;
+
+	for (size_t seen = 0; seen < capacity && (node = __atomic_load_n(&slots[slot], __ATOMIC_ACQUIRE)); seen++)
+	{
+		if (__atomic_load_n(&node->ptr, __ATOMIC_RELAXED) == ptr)
+			return node;
+		slot = (slot + 1) & (capacity - 1);
+	}
+	return NULL;
+}
+
+static void table_init(struct addressTable *table)
+{
+	table->capacity = INDEX_MIN_CAPACITY;
+	table->count = 0;
+	table->slots = calloc(table->capacity, sizeof(struct memoryList *));
+	table->oldSlots = NULL;
+	table->oldCount = 0;
+	table->retired = NULL;
+}
+
+// Make an empty table large enough for entries entries without growing.
+static void table_reserve(struct addressTable *table, size_t entries)
+{
+	while (2 * entries > table->capacity)
+		table->capacity *= 2;
+	free(table->slots);
+	table->slots = calloc(table->capacity, sizeof(struct memoryList *));
+}
+
+static void table_free(struct addressTable *table)
+{
+	free(table->slots);
+	free(table->oldSlots);
+	table->slots = table->oldSlots = NULL;
+	while (table->retired)
+	{
+		struct retiredSlots *next = table->retired->next;
+		free(table->retired->slots);
+		free(table->retired);
+		table->retired = next;
+	}
+}
+
+/* Stop using the old slots once they are empty. A remote free may still be
+ * reading them, so they are freed only when no lookup is registered, with
+ * any left over from before; otherwise they wait for a later call.
+ */
+static void table_drop_old(struct addressTable *table)
+{
+	struct retiredSlots *retired = malloc(sizeof(struct retiredSlots));
+
+	retired->slots = table->oldSlots;
+	retired->next = table->retired;
+	table->retired = retired;
+	__atomic_store_n(&table->oldSlots, NULL, __ATOMIC_SEQ_CST);
+
+	if (atomic_load(&remoteLookups[0]) || atomic_load(&remoteLookups[1]))
+		return;
+
+	while (table->retired)
+	{
+		struct retiredSlots *next = table->retired->next;
+		free(table->retired->slots);
+		free(table->retired);
+		table->retired = next;
+	}
+}
+
+/* Move up to steps entries (or empty slots passed over) from the old slots to
+ * the table. Slots below migrated are empty, so no probe run in the old slots
+ * wraps around into them, and a removal there never shifts an entry below
+ * migrated.
+ */
+static void table_migrate(struct addressTable *table, size_t steps)
+{
+	while (table->oldSlots && steps--)
+	{
+		struct memoryList *node = table->oldSlots[table->migrated];
+		if (!node)
+		{
+			table->migrated++;
+			continue;
+		}
+
+		// the removal may shift another entry into this slot, so it is looked at again
+		probe_remove(table->oldSlots, table->oldCapacity, table->migrated);
+		probe_insert(table->slots, table->capacity, node);
+		if (--table->oldCount == 0)
+			table_drop_old(table);
+	}
+}
+
+// Move every entry out of the old slots, so that slots alone holds the table.
+static void table_settle(struct addressTable *table)
+{
+	table_migrate(table, (size_t)-1);
+}
+
+static void table_grow(struct addressTable *table)
+{
+	table_settle(table);
+
+	table->oldCount = table->count;
+	table->migrated = 0;
+
+	// slots are published before their capacity, so table_peek never reads past the end of an array
+	__atomic_store_n(&table->oldSlots, table->slots, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&table->oldCapacity, table->capacity, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&table->slots, calloc(2 * table->capacity, sizeof(struct memoryList *)), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&table->capacity, 2 * table->capacity, __ATOMIC_SEQ_CST);
+}
+
+static void table_insert(struct addressTable *table, struct memoryList *node)
+{
+	table_migrate(table, INDEX_MIGRATE_STEPS);
+	if (2 * (table->count + 1) > table->capacity)
+		table_grow(table);
+
+	probe_insert(table->slots, table->capacity, node);
+	table->count++;
+}
+
+static struct memoryList *table_lookup(struct addressTable *table, void *ptr)
+{
+	size_t slot;
+
+	if (!table->slots)
+		return NULL;
+
+	if ((slot = probe_find(table->slots, table->capacity, ptr)) < table->capacity)
+		return table->slots[slot];
+	if (table->oldSlots && (slot = probe_find(table->oldSlots, table->oldCapacity, ptr)) < table->oldCapacity)
+		return table->oldSlots[slot];
+	return NULL;
+}
+
+/* table_lookup for another thread's table, without its lock (see
+ * remoteLookups). It never reads freed or out-of-bounds slots, but may miss
+ * an entry that moves meanwhile.
+ */
+static struct memoryList *table_peek(struct addressTable *table, void *ptr)
+{
+	// the capacity is read before the slots, so it is never larger than theirs
+	size_t capacity = __atomic_load_n(&table->capacity, __ATOMIC_SEQ_CST);
+	struct memoryList **slots = __atomic_load_n(&table->slots, __ATOMIC_SEQ_CST);
+	struct memoryList *node = slots ? probe_peek(slots, capacity, ptr) : NULL;
+
+	if (!node)
+	{
+		capacity = __atomic_load_n(&table->oldCapacity, __ATOMIC_SEQ_CST);
+		slots = __atomic_load_n(&table->oldSlots, __ATOMIC_SEQ_CST);
+		if (slots)
+			node = probe_peek(slots, capacity, ptr);
+	}
+	return node;
+}
+
+static void table_remove(struct addressTable *table, struct memoryList *node)
+{
+	size_t slot = probe_find(table->slots, table->capacity, node->ptr);
+
+	if (slot < table->capacity)
+	{
+		probe_remove(table->slots, table->capacity, slot);
+	}
+	else
+	{
+		probe_remove(table->oldSlots, table->oldCapacity, probe_find(table->oldSlots, table->oldCapacity, node->ptr));
+		if (--table->oldCount == 0)
+			table_drop_old(table);
+	}
+	table->count--;
+}
+
+static void index_insert(struct memoryList *node)
+{
+	table_insert(&arena->addrIndex, node);
+	page_map_insert(node);
+}
+
+static struct memoryList *index_lookup(void *ptr)
+{
+	// pointers outside the pool can never be in the index
+	if ((char *)ptr < (char *)arena->base || (char *)ptr >= (char *)arena->base + arena->size)
+		return NULL;
+
+	return table_lookup(&arena->addrIndex, ptr);
+}
+
+static void index_remove(struct memoryList *node)
+{
+	table_remove(&arena->addrIndex, node);
+	page_map_remove(node);
+}
+
+static void page_map_insert(struct memoryList *node)
+{
+	size_t page = ((char *)node->ptr - (char *)arena->base) / PAGE_MAP_UNIT;
+
+	if (!arena->pageFirst[page])
+		radix_set(&arena->blockPages, page);
+	if (!arena->pageFirst[page] || node->ptr < arena->pageFirst[page]->ptr)
+		arena->pageFirst[page] = node;
+}
+
+/* node must still link to the block after it, which then becomes the first
+ * of the page if it starts there.
+ */
+static void page_map_remove(struct memoryList *node)
+{
+	size_t page = ((char *)node->ptr - (char *)arena->base) / PAGE_MAP_UNIT;
+	struct memoryList *next = node->next;
+
+	if (arena->pageFirst[page] != node)
+		return;
+
+	if (next != node && next->ptr > node->ptr && ((char *)next->ptr - (char *)arena->base) / PAGE_MAP_UNIT == page)
+	{
+		arena->pageFirst[page] = next;
+		return;
+	}
+	arena->pageFirst[page] = NULL;
+	radix_clear(&arena->blockPages, page);
+}
+
+static void radix_init(struct radixBitmap *map, size_t bits)
+{
+	map->levels = 0;
+	do
+	{
+		map->bits[map->levels] = bits;
+		bits = (bits + 63) / 64;
+		map->words[map->levels] = calloc(bits, sizeof(unsigned long long));
+		map->levels++;
+	} while (bits > 1);
+}
+
+static void radix_set(struct radixBitmap *map, size_t bit)
+{
+	for (int level = 0; level < map->levels; level++, bit /= 64)
+	{
+		unsigned long long old = map->words[level][bit / 64];
+		map->words[level][bit / 64] = old | (1ull << (bit % 64));
+
+		// the levels above already know this word is non-empty
+		if (old)
+			break;
+	}
+}
+
+static void radix_clear(struct radixBitmap *map, size_t bit)
+{
+	for (int level = 0; level < map->levels; level++, bit /= 64)
+	{
+		map->words[level][bit / 64] &= ~(1ull << (bit % 64));
+
+		// the word still has bits set, so the levels above are unchanged
+		if (map->words[level][bit / 64])
+			break;
+	}
+}
+
+// Smallest set bit >= bit on the given level, or -1 if there is none.
+static long radix_next(struct radixBitmap *map, int level, size_t bit)
+{
+	if (bit >= map->bits[level])
+		return -1;
+
+	size_t word = bit / 64;
+	unsigned long long bits = map->words[level][word] & (~0ull << (bit % 64));
+	if (bits)
+		return word * 64 + __builtin_ctzll(bits);
+
+	// ask the level above for the next non-empty word
+	if (level + 1 == map->levels)
+		return -1;
+	long next = radix_next(map, level + 1, word + 1);
+	if (next < 0)
+		return -1;
+	return next * 64 + __builtin_ctzll(map->words[level][next]);
+}
+
+// Largest set bit <= bit on the given level, or -1 if there is none.
+static long radix_prev(struct radixBitmap *map, int level, long bit)
+{
+	if (bit < 0)
+		return -1;
+
+	size_t word = bit / 64;
+	unsigned long long bits = map->words[level][word] & (~0ull >> (63 - bit % 64));
+	if (bits)
+		return word * 64 + 63 - __builtin_clzll(bits);
+
+	// ask the level above for the previous non-empty word
+	if (level + 1 == map->levels)
+		return -1;
+	long prev = radix_prev(map, level + 1, (long)word - 1);
+	if (prev < 0)
+		return -1;
+	return prev * 64 + 63 - __builtin_clzll(map->words[level][prev]);
+}
+
+// The block that contains the given byte of the pool, or NULL for pointers outside the pool.
+static struct memoryList *block_containing(void *ptr)
+{
+	if ((char *)ptr < (char *)arena->base || (char *)ptr >= (char *)arena->base + arena->size)
+		return NULL;
+
+	// the nearest page at or before ptr where a block starts at or before ptr; the first block always starts page 0
+	long page = radix_prev(&arena->blockPages, 0, ((char *)ptr - (char *)arena->base) / PAGE_MAP_UNIT);
+	if (arena->pageFirst[page]->ptr > ptr)
+		page = radix_prev(&arena->blockPages, 0, page - 1);
+
+	struct memoryList *block = arena->pageFirst[page];
+	while (block->next != arena->head && block->next->ptr <= ptr)
+		block = block->next;
+	return block;
+}
+
+/* Whether a free block starts at an offset in [from, to) of the arena. Pages
+ * wholly inside the range are answered by freePages; a page the range only
+ * partly covers is walked block by block.
+ */
+static int free_start_between(size_t from, size_t to)
+{
+	while (from < to)
+	{
+		long page = radix_next(&arena->freePages, 0, from / PAGE_MAP_UNIT);
+		if (page < 0 || page * PAGE_MAP_UNIT >= to)
+			return 0;
+
+		size_t pageEnd = (page + 1) * PAGE_MAP_UNIT;
+		if (page * PAGE_MAP_UNIT >= from && pageEnd <= to)
+			return 1;
+
+		for (struct memoryList *trav = arena->pageFirst[page];; trav = trav->next)
+		{
+			size_t offset = (char *)trav->ptr - (char *)arena->base;
+			if (offset >= pageEnd || offset >= to)
+				break;
+			if (offset >= from && !trav->alloc)
+				return 1;
+			if (trav->next == arena->head)
+				break;
+		}
+		from = pageEnd;
+	}
+	return 0;
+}
+
+// find a suitable block in memory
+struct memoryList *find_block_next(size_t requested)
+{
+	// since im implementing next-fit make sure we start from currentnode, instead of head when searching through list.
+	struct memoryList *start = arena->currentnode;
+
+	do
+	{
+		// If we find an unallocated node, with size equal to or greater than the requested memory space then return that node.
+		if ((arena->currentnode->alloc == 0) && arena->currentnode->size >= requested)
+		{
+			return arena->currentnode;
+		}
+
+		// Ensure we don't loop indefinitely
+	} while ((arena->currentnode = arena->currentnode->next) != start);
+
+	// if we dont find a node, that means that there are no suitable nodes in memory return null
+	return NULL;
+}
+
+struct memoryList *find_block_worst(size_t requested)
+{
+	struct memoryList *largest = tree_largest();
+
+	// Even the largest hole has to be able to hold the request
+	if (largest && largest->size >= requested)
+	{
+		return largest;
+	}
+	return NULL;
+}
+
+struct memoryList *find_block_best(size_t requested)
+{
+	// The treap is ordered by (size, ptr), so the best fit is a lower-bound lookup
+	return tree_lower_bound(requested);
+}
+
+struct memoryList *find_block_first(size_t requested)
+{
+	struct memoryList *first = NULL;
+
+	// Only holes in the bins that can fit the request are candidates; pick the one with the smallest address.
+	for (int bin = bin_next_nonempty(bin_index(requested)); bin >= 0; bin = bin_next_nonempty(bin + 1))
+	{
+		for (struct memoryList *trav = arena->freeBins[bin]; trav; trav = trav->nextFree)
+		{
+			if (trav->size >= requested && (!first || trav->ptr < first->ptr))
+			{
+				first = trav;
+			}
+		}
+	}
+
+	return first;
+}
+
+struct memoryList *find_block_bitmap(size_t requested)
+{
+	// Free blocks are always merged, so every run of free bytes is exactly one free block
+	long start = bitmap_find_run(arena->freeMap, arena->size, requested);
+
+	if (start < 0)
+	{
+		return NULL;
+	}
+	return index_lookup((char *)arena->base + start);
+}
+
+/* TLSF: round the request up to the next size class, so that any block in the
+ * class that is found will fit, then find the class with two find-first-set
+ * steps: in the second-level bits of the request's own power of two, or else
+ * in the first-level bitmap for the next power of two with a free block.
+ * The block taken is the head of its bin, so the search is O(1).
+ */
+struct memoryList *find_block_tlsf(size_t requested)
+{
+	size_t rounded = requested;
+	if (requested >= BIN_SUBCLASSES)
+	{
+		rounded += (1ull << (63 - __builtin_clzll(requested) - BIN_SUBCLASS_LOG)) - 1;
+	}
+
+	int bin = bin_index(rounded);
+	int group = bin / BIN_SUBCLASSES;
+	unsigned int bins = group_bins(group) & (~0u << (bin % BIN_SUBCLASSES));
+
+	if (!bins)
+	{
+		unsigned long long groups = group + 1 < BIN_GROUPS ? arena->groupMap & (~0ull << (group + 1)) : 0;
+		if (!groups)
+		{
+			return NULL;
+		}
+		group = __builtin_ctzll(groups);
+		bins = group_bins(group);
+	}
+
+	return arena->freeBins[group * BIN_SUBCLASSES + __builtin_ctz(bins)];
+}
+
+/* Buddy: every free block is a power of two, and a power of two has a bin of
+ * its own, so the bins are the per-order free lists.
+ */
+struct memoryList *find_block_buddy(size_t requested)
+{
+	size_t order = 1;
+
+	// larger requests never fit, and would run order past the top bit
+	if (requested > arena->size)
+	{
+		return NULL;
+	}
+	while (order < requested)
+	{
+		order <<= 1;
+	}
+
+	int bin = bin_next_nonempty(bin_index(order));
+	if (bin < 0)
+	{
+		return NULL;
+	}
+	return arena->freeBins[bin];
+}
+
+/* Split a fresh arena into power-of-two chunks, largest first, so that every
+ * chunk starts at a multiple of its own size. Buddies are then found by
+ * flipping one bit of the arena offset. node must not be in the free lists yet.
+ */
+static void buddy_carve(struct memoryList *node)
+{
+	while (node->size & (node->size - 1))
+	{
+		insertBlock(node, 1 << (31 - __builtin_clz(node->size)));
+		freelist_insert(node);
+		node = node->next;
+		freelist_remove(node);
+	}
+	freelist_insert(node);
+	arena->currentnode = arena->head;
+}
+
+// The buddy of a block if it is whole (not split), otherwise NULL.
+static struct memoryList *buddy_of(struct memoryList *node)
+{
+	size_t offset = (char *)node->ptr - (char *)arena->base;
+	struct memoryList *buddy = (offset & node->size) ? node->prev : node->next;
+
+	if (buddy->ptr != (char *)arena->base + (offset ^ node->size) || buddy->size != node->size)
+	{
+		return NULL;
+	}
+	return buddy;
+}
+
+/* The status functions below come in two parts: a pool_* function that reads
+ * the state of the current arena, and the public mem_* wrapper that locks each
+ * arena in turn and combines the results.
+ */
+
+/****** Memory status/property functions ******
+ * Implement these functions.
+ * Note that when refered to "memory" here, it is meant that the 
+ * memory pool this module manages via initmem/mymalloc/myfree. 
+ */
+
+/* Get the number of contiguous areas of free space in memory. */
+static int pool_holes()
+{
+	if (myLayout == TagLayout)
+		return tag_holes(arena->base);
+
+	// every free block is a hole; blocks waiting to be merged count one by one
+	return arena->freeBlocks;
+}
+
+/* Get the number of bytes allocated */
+static int pool_allocated()
 {
+	if (myLayout == TagLayout)
+		return tag_allocated(arena->base);
 
-	// Set up a pointer to the block that we will allocate this memory to
-	struct memoryList *matching_block = NULL;
+	return arena->size - arena->freeBytes;
+}
 
-	assert((int)myStrategy > 0);
+/* Number of non-allocated bytes */
+static int pool_free()
+{
+	if (myLayout == TagLayout)
+		return tag_free_bytes(arena->base);
 
-	switch (myStrategy)
-	{
-	case NotSet:
-		return NULL;
-		break;
-	case First:
-		matching_block = find_block_first(requested);
-		break;
-	case Best:
-		matching_block = find_block_best(requested);
-		break;
-	case Worst:
-		matching_block = find_block_worst(requested);
-		break;
-	case Next:
-		matching_block = find_block_next(requested);
-		break;
-	}
+	return arena->freeBytes;
+}
 
-	// Our search didn't yield a compatible block, log this and do not allocate any memory.
-	if (!matching_block)
+/* Number of bytes in the largest contiguous area of unallocated memory */
+static int pool_largest_free()
+{
+	if (myLayout == TagLayout)
+		return tag_largest_free(arena->base);
+
+	// in the size trie, larger keys are always to the right; the nodes on the way down hold the rest
+	if (myStrategy == TLSF)
 	{
-		fprintf(stderr, "No suitable block found \n");
-		return NULL;
+		int largest = 0;
+		for (struct memoryList *trav = arena->freeTree; trav; trav = trav->treeRight ? trav->treeRight : trav->treeLeft)
+			if (trav->size > largest)
+				largest = trav->size;
+		return largest;
 	}
 
-	// If request is smaller than this blocks current size, then we will have leftover memory. Thus we need to create a new node in the list to contain this leftover memory
-	if (matching_block->size > requested)
+	// the largest block is the rightmost node of the size-ordered treap
+	struct memoryList *trav = arena->freeTree;
+
+	if (!trav)
 	{
-		insertBlock(matching_block, requested);
+		return 0;
 	}
-	// Since we will only enter this part of the code if the block that was found is exactly the size of the request -
-	// We do not need to make a new node, since the current list structure can facilitate the allocattion of the request, with memory leftover.
-	// simply update the currentnode to point to the current nodes next node. Before allocating it and returning the pointer for the matched block
 
-	// This could also be seen as (if block->size == requested)
-	else
+	while (trav->treeRight)
 	{
-		currentnode = matching_block->next;
+		trav = trav->treeRight;
 	}
-	// Indicate that the matched block has been allocated and return a pointer to it.
-	matching_block->alloc = 1;
-
-	return matching_block->ptr;
+	return trav->size;
 }
 
-void myfree(void *block)
+/* Number of free blocks smaller than "size" bytes. */
+static int pool_small_free(int size)
 {
-	// Iniate a pointer to traverse the list
-	struct memoryList *trav;
-	// Since its a circular list, make sure we dont loop forever, by stopping at the last node.
-	for (trav = head; trav->next != head; trav = trav->next)
+	int count = 0;
+
+	if (myLayout == TagLayout)
+		return tag_small_free(arena->base, size);
+
+	// Rank query on the size trie: follow the first key above size, and wherever
+	// it goes right, the left subtree is all below it.
+	if (myStrategy == TLSF)
 	{
-		if (trav->ptr == block)
+		if (size < 0)
+			return 0;
+		if ((size_t)size >= arena->size)
+			return arena->freeBlocks;
+
+		unsigned long long limit = (unsigned long long)(size + 1) << trie_bits();
+		int bit = 2 * trie_bits();
+		struct memoryList *trav = arena->freeTree;
+		while (trav)
 		{
-			break;
+			count += trav->size <= size;
+			bit--;
+			if (limit >> bit & 1)
+			{
+				count += tree_count(trav->treeLeft);
+				trav = trav->treeRight;
+			}
+			else
+			{
+				trav = trav->treeLeft;
+			}
 		}
+		return count;
 	}
-	// Mark the block as freed. If no adjacent blocks are also free, then do nothing else.
-	trav->alloc = 0;
 
-	// If the block isnt the head of the list, and the previous node isn't allocated merge into one block
-	if ((trav != head) && !(trav->prev->alloc))
+	// Rank query on the size-ordered treap: whenever a block is small enough,
+	// it and its whole left subtree count, and the search continues to the right.
+	struct memoryList *trav = arena->freeTree;
+	while (trav)
 	{
-		// set up helper pointer
-		struct memoryList *previous = trav->prev;
-		free_adjacent(trav);
-		// since we are merging the contents of this block into the adjacent block, move the trav pointer space back in the list
-		trav = previous;
+		if (trav->size <= size)
+		{
+			count += 1 + tree_count(trav->treeLeft);
+			trav = trav->treeRight;
+		}
+		else
+		{
+			trav = trav->treeLeft;
+		}
 	}
 
-	// likewise for the next block
-	if (trav->next != head && !(trav->next->alloc))
-	{
-		free_adjacent(trav->next);
-	}
+	return count;
 }
 
-void *free_adjacent(struct memoryList *blockToMerge)
+/* Distribution of hole sizes: counts[k] is set to the number of free blocks
+ * with a size in [2^k, 2^(k+1)); the last bucket also takes every larger block.
+ * Returns the total number of holes.
+ */
+static int pool_hole_histogram(int *counts, int buckets)
 {
+	if (myLayout == TagLayout)
+		return tag_hole_histogram(arena->base, counts, buckets);
 
-	// Merge the matching blocks memory into the previous block
-	blockToMerge->prev->size += blockToMerge->size;
-
-	// Setup the new connection after removal from the list
-	blockToMerge->prev->next = blockToMerge->next;
-	blockToMerge->next->prev = blockToMerge->prev;
+	memset(counts, 0, buckets * sizeof(int));
 
-	// If our currentnode is pointing to the block to be freed, make sure currentnode doesnt point to a freed node.
-	if (currentnode == blockToMerge)
+	// each power of two spans BIN_SUBCLASSES bins (or fewer for the smallest sizes)
+	for (int bin = 1; bin < BIN_COUNT; bin++)
 	{
-		currentnode = currentnode->prev;
+		if (!arena->binCounts[bin])
+			continue;
+
+		int log = bin < BIN_SUBCLASSES ? 31 - __builtin_clz(bin) : bin / BIN_SUBCLASSES + BIN_SUBCLASS_LOG - 1;
+		counts[log < buckets ? log : buckets - 1] += arena->binCounts[bin];
 	}
 
-	// free the node
-	free(blockToMerge);
+	return arena->freeBlocks;
 }
 
-void insertBlock(struct memoryList *node, size_t requested)
+static char pool_is_alloc(void *ptr)
 {
-	// Create a new node, this node is to be set adjacent to the matched node (current node)
-	struct memoryList *newnode = malloc(sizeof(struct memoryList));
-
-	// Setting up connection for the new node
-	newnode->next = node->next;
-	newnode->next->prev = newnode;
-	newnode->prev = node;
-	node->next = newnode;
-
-	// set the values for the newnode
-	// The size of the new (free) node will be whatever is remaining of the matched node after subtracting the requested memory space
-	newnode->size = node->size - requested;
-	newnode->ptr = node->ptr + requested;
-	newnode->alloc = 0;
+	if (myLayout == TagLayout)
+		return tag_is_alloc(arena->base, ptr);
 
-	// set the matched node to be equal the size of the request
-	node->size = requested;
+	// Find the owning block through the page map
+	struct memoryList *block = block_containing(ptr);
 
-	// Make sure we start from this point when inserting new node
-	currentnode = newnode;
+	return block ? block->alloc : 0;
 }
 
-// find a suitable block in memory
-struct memoryList *find_block_next(size_t requested)
+/* Is the range [ptr, ptr + len) fully allocated, fully free or mixed?
+ * Returns MEM_RANGE_ALLOC, MEM_RANGE_FREE or MEM_RANGE_MIXED, or MEM_RANGE_INVALID
+ * if the range is empty or does not lie inside the pool.
+ */
+static int pool_is_alloc_range(void *ptr, size_t len)
 {
-	// since im implementing next-fit make sure we start from currentnode, instead of head when searching through list.
-	struct memoryList *start = currentnode;
+	if (myLayout == TagLayout)
+		return tag_is_alloc_range(arena->base, ptr, len);
 
-	do
+	struct memoryList *block = block_containing(ptr);
+	size_t end = (char *)ptr - (char *)arena->base + len;
+
+	if (!block || len == 0 || end > arena->size)
+		return MEM_RANGE_INVALID;
+
+	// the whole range lies inside one block
+	if ((char *)block->ptr + block->size >= (char *)ptr + len)
+		return block->alloc ? MEM_RANGE_ALLOC : MEM_RANGE_FREE;
+
+	// Free blocks are never adjacent, so a range over several blocks is fully
+	// allocated exactly when none of them is free.
+	if (!block->alloc && myStrategy != Buddy && !arena->quickBlocks)
+		return MEM_RANGE_MIXED;
+
+	// ...except under buddy, where free neighbours that are not buddies stay apart,
+	// and while freed blocks wait to be merged
+	if (!block->alloc)
 	{
-		// If we find an unallocated node, with size equal to or greater than the requested memory space then return that node.
-		if ((currentnode->alloc == 0) && currentnode->size >= requested)
+		for (struct memoryList *trav = block->next; trav != arena->head && (char *)trav->ptr < (char *)ptr + len; trav = trav->next)
 		{
-			return currentnode;
+			if (trav->alloc)
+				return MEM_RANGE_MIXED;
 		}
+		return MEM_RANGE_FREE;
+	}
 
-		// Ensure we don't loop indefinitely
-	} while ((currentnode = currentnode->next) != start);
+	if (free_start_between((char *)block->ptr - (char *)arena->base + block->size, end))
+		return MEM_RANGE_MIXED;
 
-	// if we dont find a node, that means that there are no suitable nodes in memory return null
-	return NULL;
+	return MEM_RANGE_ALLOC;
 }
 
-struct memoryList *find_block_worst(size_t requested)
+/* Bytes spent on bookkeeping for the current pool, so the layouts can be compared.
+ * For the list layout this is the live nodes and the index tables, all outside
+ * the pool; for the tag layout it is the heap state and tags inside the pool.
+ */
+static int pool_overhead()
 {
-	mem_largest_free();
-	return largestFree;
+	if (myLayout == TagLayout)
+		return tag_overhead(arena->base);
+
+	size_t bytes = arena->addrIndex.count * sizeof(struct memoryList) + arena->addrIndex.capacity * sizeof(struct memoryList *);
+	if (arena->addrIndex.oldSlots)
+		bytes += arena->addrIndex.oldCapacity * sizeof(struct memoryList *);
+	bytes += sizeof(arena->freeBins) + sizeof(arena->binCounts) + sizeof(arena->binMap);
+
+	bytes += arena->blockPages.bits[0] * (sizeof(struct memoryList *) + sizeof(unsigned short));
+	for (int level = 0; level < arena->blockPages.levels; level++)
+	{
+		bytes += 2 * ((arena->blockPages.bits[level] + 63) / 64) * sizeof(unsigned long long);
+	}
+	if (arena->freeMap)
+		bytes += (arena->size + 63) / 64 * sizeof(unsigned long long);
+	return bytes;
 }
 
-struct memoryList *find_block_best(size_t requested)
+/* Bytes handed out beyond what was requested, i.e. internal fragmentation:
+ * buddy and minimum alignment round requests up. The tag layout does not
+ * record request sizes.
+ */
+static int pool_internal_fragmentation()
 {
-	struct memoryList *lowest = NULL;
-	struct memoryList *trav = head;
-	int lowestSize = mySize + 1;
+	if (myLayout == TagLayout)
+		return 0;
 
-	do
-	{
-		if (trav->alloc == 0)
-		{
-			if (trav->size >= requested && trav->size < lowestSize)
-			{
-				lowest = trav;
-				lowestSize = lowest->size;
-			}
-		}
-	} while ((trav = trav->next) != head);
+	return arena->wastedBytes;
+}
 
-	if (lowest)
+int mem_holes()
+{
+	int holes = 0;
+	for (int i = 0; i < arenaCount; i++)
 	{
-		return lowest;
+		arena_enter(&arenas[i]);
+		holes += pool_holes();
+		arena_leave();
 	}
-	else
+	return holes;
+}
+
+int mem_allocated()
+{
+	int allocated = 0;
+	for (int i = 0; i < arenaCount; i++)
 	{
-		return NULL;
+		arena_enter(&arenas[i]);
+		allocated += pool_allocated();
+		arena_leave();
 	}
+	return allocated;
 }
 
-struct memoryList *find_block_first(size_t requested)
+int mem_free()
 {
-	struct memoryList *trav = head;
+	int free = 0;
+	for (int i = 0; i < arenaCount; i++)
+	{
+		arena_enter(&arenas[i]);
+		free += pool_free();
+		arena_leave();
+	}
+	return free;
+}
 
-	do
+int mem_largest_free()
+{
+	int largest = 0;
+	for (int i = 0; i < arenaCount; i++)
 	{
-		if (trav->size >= requested && !(trav->alloc))
-		{
-			return trav;
-		}
-	} while ((trav = trav->next) != head);
+		arena_enter(&arenas[i]);
+		int arenaLargest = pool_largest_free();
+		arena_leave();
 
-	return NULL;
+		if (arenaLargest > largest)
+			largest = arenaLargest;
+	}
+	return largest;
 }
-/****** Memory status/property functions ******
- * Implement these functions.
- * Note that when refered to "memory" here, it is meant that the 
- * memory pool this module manages via initmem/mymalloc/myfree. 
- */
 
-/* Get the number of contiguous areas of free space in memory. */
-int mem_holes()
+int mem_small_free(int size)
 {
-
-	struct memoryList *trav = head;
 	int count = 0;
+	for (int i = 0; i < arenaCount; i++)
+	{
+		arena_enter(&arenas[i]);
+		count += pool_small_free(size);
+		arena_leave();
+	}
+	return count;
+}
 
-	do
+int mem_hole_histogram(int *counts, int buckets)
+{
+	int holes = 0;
+	int arenaCounts[buckets];
+
+	memset(counts, 0, buckets * sizeof(int));
+	for (int i = 0; i < arenaCount; i++)
 	{
-		// if trav->alloc == 0 then we have found a hole, add one to the count
-		if (!trav->alloc)
-		{
-			count += 1;
-		}
-		// loop from start to end
-	} while ((trav = trav->next) != head);
+		arena_enter(&arenas[i]);
+		holes += pool_hole_histogram(arenaCounts, buckets);
+		arena_leave();
 
-	return count;
+		for (int k = 0; k < buckets; k++)
+			counts[k] += arenaCounts[k];
+	}
+	return holes;
 }
 
-/* Get the number of bytes allocated */
-int mem_allocated()
+char mem_is_alloc(void *ptr)
 {
-	return mySize - mem_free();
+	if (!arena_of(ptr))
+		return 0;
+
+	arena_enter(arena_of(ptr));
+	char alloc = pool_is_alloc(ptr);
+	arena_leave();
+	return alloc;
 }
 
-/* Number of non-allocated bytes */
-int mem_free()
+/* A range may cross arena boundaries: every arena reports on its own part and
+ * the range is only fully allocated or fully free if all of them agree.
+ */
+int mem_is_alloc_range(void *ptr, size_t len)
 {
+	char *start = ptr;
+	char *end = start + len;
 
-	int count = 0;
+	if (len == 0 || !arena_of(start) || !arena_of(end - 1))
+		return MEM_RANGE_INVALID;
 
-	// iterate over list
-	struct memoryList *trav = head;
-	do
+	int state = -2;
+	for (char *from = start, *to; from < end; from = to)
 	{
-		// If the block isnt allocated add its size to the total pool of free memory
-		if (!(trav->alloc))
-		{
-			count += trav->size;
-		}
-	} while ((trav = trav->next) != head);
+		struct arena *part = arena_of(from);
 
-	return count;
+		// segments need not be next to each other
+		if (!part)
+			return MEM_RANGE_INVALID;
+		to = end < (char *)part->base + part->size ? end : (char *)part->base + part->size;
+
+		arena_enter(part);
+		int partState = pool_is_alloc_range(from, to - from);
+		arena_leave();
+
+		if (partState == MEM_RANGE_INVALID)
+			return MEM_RANGE_INVALID;
+		if (state == -2)
+			state = partState;
+		else if (state != partState)
+			return MEM_RANGE_MIXED;
+	}
+	return state;
 }
 
-/* Number of bytes in the largest contiguous area of unallocated memory */
-int mem_largest_free()
+int mem_overhead()
 {
+	int bytes = 0;
+	for (int i = 0; i < arenaCount; i++)
+	{
+		arena_enter(&arenas[i]);
+		bytes += pool_overhead();
+		arena_leave();
+	}
+	return bytes;
+}
 
-	// Iterate over memory list and find the largest unallocated node
-
-	largestFree = NULL;
+int mem_internal_fragmentation()
+{
+	int bytes = 0;
+	for (int i = 0; i < arenaCount; i++)
+	{
+		arena_enter(&arenas[i]);
+		bytes += pool_internal_fragmentation();
+		arena_leave();
+	}
+	return bytes;
+}
 
-	struct memoryList *trav = head;
-	do
+/* Give the whole pages inside every free block back to the OS, so that the
+ * pool only keeps what is in use resident. Returns the bytes given back.
+ * Blocks in thread caches count as allocated and are left alone.
+ */
+int mem_trim()
+{
+	size_t released = 0;
+	for (int i = 0; i < arenaCount; i++)
 	{
-		if (!trav->alloc)
+		arena_enter(&arenas[i]);
+		if (myLayout == TagLayout)
 		{
-			if (!largestFree)
-			{
-				largestFree = trav;
-			}
-			else if (trav->size > largestFree->size)
-			{
-				largestFree = trav;
-			}
+			released += tag_trim(arena->base, pageSize);
 		}
-	} while ((trav = trav->next) != head);
+		else
+		{
+			// merged blocks have more whole pages inside
+			quick_flush();
 
-	if (largestFree)
-	{
-		return largestFree->size;
+			struct memoryList *node = arena->head;
+			do
+			{
+				if (!node->alloc)
+					released += trim_block(node);
+			} while ((node = node->next) != arena->head);
+		}
+		arena_leave();
 	}
-	else
+	return released;
+}
+
+// Bytes of a mapping that are in RAM.
+static size_t resident_bytes(void *mapping, size_t size)
+{
+	size_t pages = (size + pageSize - 1) / pageSize;
+	unsigned char *vec = malloc(pages);
+	size_t bytes = 0;
+
+	if (vec && !mincore(mapping, size, vec))
 	{
-		return 0;
+		for (size_t i = 0; i < pages; i++)
+			bytes += (vec[i] & 1) * pageSize;
 	}
+	free(vec);
+	return bytes;
 }
 
-/* Number of free blocks smaller than "size" bytes. */
-int mem_small_free(int size)
+/* Bytes of the pool that are in RAM, i.e. what the pool adds to the RSS of
+ * the process. Next to mem_allocated it shows how much mem_trim could give back.
+ */
+int mem_resident()
 {
-	int count = 0;
+	size_t bytes = poolMapping ? resident_bytes(poolMapping, poolMappingSize) : 0;
 
-	// iterate through the list and find the number of allocated bytes smaller than size
+	for (int i = sliceCount; i < arenaCount; i++)
+		bytes += resident_bytes(arenas[i].mapping, arenas[i].mappingSize);
+	return bytes;
+}
+
+// Write all of buf to fd, leaving holes where whole pages are zero.
+static int write_sparse(int fd, const char *buf, size_t len)
+{
+	static const char zeroPage[POOL_ALIGN];
 
-	for (struct memoryList *trav = head; trav->next != head; trav = trav->next)
+	for (size_t done = 0; done < len;)
 	{
-		if (trav->size <= size && !(trav->alloc))
+		size_t chunk = len - done < POOL_ALIGN ? len - done : POOL_ALIGN;
+
+		if (chunk == POOL_ALIGN && !memcmp(buf + done, zeroPage, POOL_ALIGN))
 		{
-			count += 1;
+			done += chunk;
+			continue;
 		}
-	}
 
-	return count;
+		ssize_t written = pwrite(fd, buf + done, chunk, done);
+		if (written <= 0)
+			return -1;
+		done += written;
+	}
+	return ftruncate(fd, len);
 }
 
-char mem_is_alloc(void *ptr)
+/* Write a snapshot of a file-backed pool (see initmem_file) to its file.
+ * The snapshot goes to a temporary file first, which replaces the old one
+ * only once it is on disk, so after a crash the file holds either this
+ * snapshot or the previous one, never a mix of the two. Blocks should not
+ * change while it runs. Returns 0, or -1 if the pool is not file-backed or
+ * the snapshot could not be written.
+ */
+int mem_sync()
 {
+	if (!poolPath)
+		return -1;
 
-	//  Iterate over the list
-	struct memoryList *trav;
+	char tmp[strlen(poolPath) + 5];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", poolPath);
 
-	for (trav = head; trav->next != head; trav = trav->next)
-	{
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
 
-		if (ptr < trav->next->ptr)
-		{
-			return trav->alloc;
-		}
+	// the heap state must not change halfway through
+	arena_enter(&arenas[0]);
+	int failed = write_sparse(fd, poolMapping, poolMappingSize);
+	arena_leave();
+
+	failed = fsync(fd) || failed;
+	failed = close(fd) || failed;
+	if (failed || rename(tmp, poolPath))
+	{
+		unlink(tmp);
+		return -1;
 	}
-	return trav->alloc;
+
+	// the rename itself is only durable once the directory is synced
+	char dir[strlen(poolPath) + 2];
+	strcpy(dir, poolPath);
+	char *slash = strrchr(dir, '/');
+	if (slash)
+		slash[slash == dir] = 0;
+	else
+		strcpy(dir, ".");
+
+	fd = open(dir, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	failed = fsync(fd);
+	close(fd);
+	return failed ? -1 : 0;
+}
+
+/* The root block of a file-backed pool: one block that mem_root finds again
+ * after a restart, from which the rest of the data can be reached. NULL
+ * clears it. Kept in the file with the next mem_sync.
+ */
+void mem_set_root(void *ptr)
+{
+	if (poolPath)
+		((struct fileHeader *)poolMapping)->root = ptr ? (char *)ptr - (char *)myMemory : 0;
+}
+
+// The root block of a file-backed pool, or NULL if there is none.
+void *mem_root()
+{
+	if (!poolPath || !((struct fileHeader *)poolMapping)->root)
+		return NULL;
+	return (char *)myMemory + ((struct fileHeader *)poolMapping)->root;
 }
 
 /* 
@@ -432,6 +3999,26 @@ char *strategy_name(strategies strategy)
 		return "first";
 	case Next:
 		return "next";
+	case Bitmap:
+		return "bitmap";
+	case Buddy:
+		return "buddy";
+	case TLSF:
+		return "tlsf";
+	default:
+		return "unknown";
+	}
+}
+
+// Get string name for a metadata layout.
+char *layout_name(layouts layout)
+{
+	switch (layout)
+	{
+	case ListLayout:
+		return "list";
+	case TagLayout:
+		return "tags";
 	default:
 		return "unknown";
 	}
@@ -456,6 +4043,18 @@ strategies strategyFromString(char *strategy)
 	{
 		return Next;
 	}
+	else if (!strcmp(strategy, "bitmap"))
+	{
+		return Bitmap;
+	}
+	else if (!strcmp(strategy, "buddy"))
+	{
+		return Buddy;
+	}
+	else if (!strcmp(strategy, "tlsf"))
+	{
+		return TLSF;
+	}
 	else
 	{
 		return 0;
@@ -470,18 +4069,35 @@ strategies strategyFromString(char *strategy)
 /* Use this function to print out the current contents of memory. */
 void print_memory()
 {
-	/* Iterate over memory list */
-	printf("Memory List {\n");
-	/* Iterate over memory list */
-	struct memoryList *index = head;
-	do
+	for (int i = 0; i < arenaCount; i++)
 	{
-		printf("\tBlock %p,\tsize %d,\t%s\n",
-			   index->ptr,
-			   index->size,
-			   (index->alloc ? "[ALLOCATED]" : "[FREE]"));
-	} while ((index = index->next) != head);
-	printf("}\n");
+		arena_enter(&arenas[i]);
+
+		if (arenaCount > 1)
+			printf("Arena %d:\n", i);
+
+		if (myLayout == TagLayout)
+		{
+			tag_print(arena->base);
+			arena_leave();
+			continue;
+		}
+
+		/* Iterate over memory list */
+		printf("Memory List {\n");
+		/* Iterate over memory list */
+		struct memoryList *index = arena->head;
+		do
+		{
+			printf("\tBlock %p,\tsize %d,\t%s\n",
+				   index->ptr,
+				   index->size,
+				   (index->alloc ? "[ALLOCATED]" : "[FREE]"));
+		} while ((index = index->next) != arena->head);
+		printf("}\n");
+
+		arena_leave();
+	}
 }
 
 /* Use this function to track memory allocation performance.  
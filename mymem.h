@@ -6,16 +6,65 @@ typedef enum strategies_enum
 	Best = 1,
 	Worst = 2,
 	First = 3,
-	Next = 4
+	Next = 4,
+	Bitmap = 5, // first fit found by scanning a bitmap of free bytes
+	Buddy = 6,	// power-of-two buddy blocks (list layout only)
+	TLSF = 7	// two-level segregated fit, constant-time good fit
 } strategies;
 
+typedef enum layouts_enum
+{
+	ListLayout = 0, // block metadata in list nodes outside the pool
+	TagLayout = 1	// boundary tags inside the pool
+} layouts;
+
+/* Optional settings for initmem_opts. A zeroed struct gives the defaults. */
+struct mem_options
+{
+	layouts layout;
+	int thread_cache; // keep per-thread caches of freed blocks (list layout only)
+	int arenas;		  // split the pool into this many independently locked arenas (0 or 1: one)
+	size_t alignment; // every block starts on a multiple of this power of two (0: no minimum)
+	int lazy_coalesce; // let up to this many freed blocks wait unmerged per arena (0: merge at once; list layout only)
+	int grow;		  // map another segment when the pool is full, instead of failing
+	size_t max_size;  // with grow: the most bytes the pool may reach in all (0: up to INT_MAX)
+	size_t trim_threshold; // give free blocks of at least this many bytes back to the OS as they form (0: only on mem_trim; list layout only)
+	int huge_pages;	  // 1: ask for transparent huge pages, falling back to normal pages; -1: refuse them (0: the kernel's default)
+};
+
 char *strategy_name(strategies strategy);
 strategies strategyFromString(char * strategy);
+char *layout_name(layouts layout);
 
 
 void initmem(strategies strategy, size_t sz);
+void initmem_opts(strategies strategy, size_t sz, const struct mem_options *options);
+
+/* file-backed pools that survive a restart, see initmem_file */
+int initmem_file(const char *path, strategies strategy, size_t sz);
+int mem_sync();
+void mem_set_root(void *ptr);
+void *mem_root();
+
+/* a pool shared by several processes, see initmem_shared */
+int initmem_shared(const char *name, strategies strategy, size_t sz);
+
 void *mymalloc(size_t requested);
 void myfree(void* block);
+void myfree_sized(void *block, size_t size);
+void *myrealloc(void *block, size_t newsize);
+void *mymemalign(size_t alignment, size_t size);
+void *mycalloc(size_t n, size_t size);
+int mymalloc_batch(const size_t *sizes, int n, void **out);
+void myfree_batch(void **ptrs, int n);
+
+/* movable blocks, see mem_compact; 0 is never a valid handle */
+typedef int mem_handle;
+mem_handle mymalloc_handle(size_t requested);
+void *mem_deref(mem_handle handle);
+void myfree_handle(mem_handle handle);
+void mem_compact();
+int mem_compact_step(long budget_us);
 
 int mem_holes();
 int mem_allocated();
@@ -23,7 +72,20 @@ int mem_free();
 int mem_total();
 int mem_largest_free();
 int mem_small_free(int size);
+int mem_hole_histogram(int *counts, int buckets);
 char mem_is_alloc(void *ptr);
+
+/* results of mem_is_alloc_range */
+#define MEM_RANGE_INVALID -1
+#define MEM_RANGE_FREE 0
+#define MEM_RANGE_ALLOC 1
+#define MEM_RANGE_MIXED 2
+int mem_is_alloc_range(void *ptr, size_t len);
+int mem_overhead();
+int mem_internal_fragmentation();
+int mem_trim();
+int mem_resident();
+void mem_flush_thread_cache();
 void* mem_pool();
 void print_memory();
 void print_memory_status();
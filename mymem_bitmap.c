@@ -0,0 +1,171 @@
+#include <string.h>
+#include "mymem_bitmap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITMAP_X86
+#endif
+
+/* A skip kernel returns the index of the first word in [from, count) that is
+ * not equal to fill (all zeros or all ones), or count if there is none.
+ */
+typedef size_t (*skipKernel)(const unsigned long long *words, size_t from, size_t count, unsigned long long fill);
+
+static size_t skip_scalar(const unsigned long long *words, size_t from, size_t count, unsigned long long fill)
+{
+	while (from < count && words[from] == fill)
+		from++;
+	return from;
+}
+
+#ifdef BITMAP_X86
+/* The fill is the same in every byte, so a byte-wise compare is exact and
+ * needs nothing beyond SSE2 and AVX2.
+ */
+__attribute__((target("sse2"))) static size_t skip_sse2(const unsigned long long *words, size_t from, size_t count, unsigned long long fill)
+{
+	__m128i pattern = _mm_set1_epi8((char)fill);
+
+	// two words per compare; the scalar loop finds the word inside the pair and handles the tail
+	for (; from + 2 <= count; from += 2)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(words + from));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)) != 0xffff)
+			break;
+	}
+	return skip_scalar(words, from, count, fill);
+}
+
+__attribute__((target("avx2"))) static size_t skip_avx2(const unsigned long long *words, size_t from, size_t count, unsigned long long fill)
+{
+	__m256i pattern = _mm256_set1_epi8((char)fill);
+
+	// four words per compare
+	for (; from + 4 <= count; from += 4)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(words + from));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern)) != -1)
+			break;
+	}
+	return skip_scalar(words, from, count, fill);
+}
+#endif
+
+// fastest first
+static const struct
+{
+	const char *name;
+	skipKernel skip;
+} kernels[] = {
+#ifdef BITMAP_X86
+	{"avx2", skip_avx2},
+	{"sse2", skip_sse2},
+#endif
+	{"scalar", skip_scalar},
+};
+
+static skipKernel skip;
+static const char *skipName;
+
+static int kernel_supported(const char *name)
+{
+#ifdef BITMAP_X86
+	__builtin_cpu_init();
+	if (!strcmp(name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+#endif
+	return !strcmp(name, "scalar");
+}
+
+/* Select the skip kernel by name, or the fastest one this CPU supports when
+ * name is NULL. Returns 0 (and keeps the current kernel) if the named kernel
+ * is unknown or not supported here.
+ */
+int bitmap_use_kernel(const char *name)
+{
+	for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+	{
+		if (name && strcmp(name, kernels[i].name))
+			continue;
+		if (!kernel_supported(kernels[i].name))
+			continue;
+
+		skip = kernels[i].skip;
+		skipName = kernels[i].name;
+		return 1;
+	}
+	return 0;
+}
+
+// Name of the selected kernel, or NULL before the first bitmap_use_kernel.
+const char *bitmap_kernel_name()
+{
+	return skipName;
+}
+
+static unsigned long long range_mask(size_t from, size_t n)
+{
+	return (n == 64 ? ~0ull : (1ull << n) - 1) << (from % 64);
+}
+
+void bitmap_set_range(unsigned long long *words, size_t from, size_t len)
+{
+	for (size_t to = from + len; from < to;)
+	{
+		size_t n = 64 - from % 64 < to - from ? 64 - from % 64 : to - from;
+		words[from / 64] |= range_mask(from, n);
+		from += n;
+	}
+}
+
+void bitmap_clear_range(unsigned long long *words, size_t from, size_t len)
+{
+	for (size_t to = from + len; from < to;)
+	{
+		size_t n = 64 - from % 64 < to - from ? 64 - from % 64 : to - from;
+		words[from / 64] &= ~range_mask(from, n);
+		from += n;
+	}
+}
+
+// First bit at or after bit that is set (free) or clear (allocated), or count * 64.
+static size_t next_bit(const unsigned long long *words, size_t count, size_t bit, int set)
+{
+	unsigned long long fill = set ? 0 : ~0ull; // words holding no bit of the wanted kind
+	size_t word = bit / 64;
+
+	if (word >= count)
+		return count * 64;
+
+	unsigned long long bits = (words[word] ^ fill) & (~0ull << (bit % 64));
+	if (bits)
+		return word * 64 + __builtin_ctzll(bits);
+
+	word = skip(words, word + 1, count, fill);
+	if (word == count)
+		return count * 64;
+	return word * 64 + __builtin_ctzll(words[word] ^ fill);
+}
+
+/* Lowest run of at least len free bits among the first bits bits, or -1.
+ * Bits past the end must be clear, so that no run runs off the map.
+ */
+long bitmap_find_run(const unsigned long long *words, size_t bits, size_t len)
+{
+	size_t count = (bits + 63) / 64;
+
+	for (size_t bit = 0; bit < bits;)
+	{
+		size_t start = next_bit(words, count, bit, 1);
+		if (start >= bits)
+			break;
+
+		size_t end = next_bit(words, count, start, 0);
+		if (end - start >= len)
+			return start;
+		bit = end;
+	}
+	return -1;
+}
@@ -0,0 +1,13 @@
+#include <stddef.h>
+
+/* Allocation bitmaps for the Bitmap strategy: one bit per byte of an arena,
+ * set while the byte is free. A free block is a maximal run of set bits.
+ * Runs are found by skipping whole words that are all allocated or all free;
+ * the skipping is done by an AVX2, SSE2 or plain C kernel, picked at run time.
+ */
+void bitmap_set_range(unsigned long long *words, size_t from, size_t len);
+void bitmap_clear_range(unsigned long long *words, size_t from, size_t len);
+long bitmap_find_run(const unsigned long long *words, size_t bits, size_t len);
+
+int bitmap_use_kernel(const char *name);
+const char *bitmap_kernel_name();
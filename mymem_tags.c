@@ -0,0 +1,608 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mymem.h"
+#include "mymem_tags.h"
+
+/* Block layout, Knuth-style boundary tags:
+ *
+ *   [header][payload ... ][footer]
+ *
+ * Header and footer are one word each and hold the block size (a multiple of
+ * TAG_WORD, tags included) with the allocation bit in the lowest bit. Free
+ * blocks also store the offsets of their neighbours in the free list at the
+ * start of the payload, which is why no block is smaller than TAG_MIN_BLOCK.
+ * The footer lets myfree find the previous block, so merging with either
+ * neighbour is plain pointer arithmetic.
+ *
+ * A process sharing the heap may die between any two writes (see
+ * tag_repair). Headers alone chain the blocks together, so every change is
+ * made visible by the last header it writes: a block's footer is written
+ * before its header, and a block is split back to front, ending with the
+ * header of the block that was split.
+ */
+#define TAG_WORD sizeof(size_t)
+#define TAG_OVERHEAD (2 * TAG_WORD)
+#define TAG_MIN_BLOCK (4 * TAG_WORD)
+#define TAG_ALLOC ((size_t)1)
+#define TAG_NIL ((size_t)-1)
+
+// Heap state, stored in the first bytes of the region.
+struct tagHeap
+{
+	size_t size;	   // bytes in the region, including this header
+	size_t firstBlock; // offset of the first block
+	size_t end;		   // offset just past the last block
+	size_t freeHead;   // offset of the first free block, or TAG_NIL
+	size_t rover;	   // next-fit: offset to continue searching from
+	size_t freeBytes;  // payload bytes in free blocks
+	size_t tagBytes;   // header and footer bytes of all blocks
+	int freeBlocks;
+	int blocks;
+};
+
+static size_t *tag_word(void *base, size_t offset)
+{
+	return (size_t *)((char *)base + offset);
+}
+
+static size_t block_size(void *base, size_t offset)
+{
+	return *tag_word(base, offset) & ~TAG_ALLOC;
+}
+
+static int block_alloc(void *base, size_t offset)
+{
+	return *tag_word(base, offset) & TAG_ALLOC;
+}
+
+// Write the footer and then the header of the block at offset.
+static void set_tags(void *base, size_t offset, size_t size, int alloc)
+{
+	*tag_word(base, offset + size - TAG_WORD) = size | (alloc ? TAG_ALLOC : 0);
+	atomic_signal_fence(memory_order_seq_cst);
+	*tag_word(base, offset) = size | (alloc ? TAG_ALLOC : 0);
+	atomic_signal_fence(memory_order_seq_cst);
+}
+
+// free-list links live in the payload of free blocks
+static size_t *next_free(void *base, size_t offset)
+{
+	return tag_word(base, offset + TAG_WORD);
+}
+
+static size_t *prev_free(void *base, size_t offset)
+{
+	return tag_word(base, offset + 2 * TAG_WORD);
+}
+
+static void freelist_push(struct tagHeap *heap, size_t offset)
+{
+	void *base = heap;
+
+	*prev_free(base, offset) = TAG_NIL;
+	*next_free(base, offset) = heap->freeHead;
+	if (heap->freeHead != TAG_NIL)
+		*prev_free(base, heap->freeHead) = offset;
+	heap->freeHead = offset;
+
+	heap->freeBytes += block_size(base, offset) - TAG_OVERHEAD;
+	heap->freeBlocks++;
+}
+
+static void freelist_unlink(struct tagHeap *heap, size_t offset)
+{
+	void *base = heap;
+	size_t next = *next_free(base, offset);
+	size_t prev = *prev_free(base, offset);
+
+	if (prev != TAG_NIL)
+		*next_free(base, prev) = next;
+	else
+		heap->freeHead = next;
+
+	if (next != TAG_NIL)
+		*prev_free(base, next) = prev;
+
+	heap->freeBytes -= block_size(base, offset) - TAG_OVERHEAD;
+	heap->freeBlocks--;
+}
+
+void tag_init(void *base, size_t sz)
+{
+	struct tagHeap *heap = base;
+
+	heap->size = sz;
+	heap->firstBlock = (sizeof(struct tagHeap) + TAG_WORD - 1) & ~(TAG_WORD - 1);
+	heap->end = heap->firstBlock;
+	heap->freeHead = TAG_NIL;
+	heap->rover = heap->firstBlock;
+	heap->freeBytes = 0;
+	heap->tagBytes = 0;
+	heap->freeBlocks = 0;
+	heap->blocks = 0;
+
+	// the whole region after the heap state becomes one free block
+	size_t size = (sz - heap->firstBlock) & ~(TAG_WORD - 1);
+	if (sz < heap->firstBlock + TAG_MIN_BLOCK)
+		return;
+
+	set_tags(base, heap->firstBlock, size, 0);
+	heap->end = heap->firstBlock + size;
+	heap->tagBytes = TAG_OVERHEAD;
+	heap->blocks = 1;
+	freelist_push(heap, heap->firstBlock);
+}
+
+void *tag_malloc(void *base, strategies strategy, size_t requested)
+{
+	return tag_memalign(base, strategy, TAG_WORD, requested);
+}
+
+/* Bytes to skip from the block at offset to the first block whose payload is
+ * a multiple of alignment. Skipped bytes become a free block of their own, so
+ * a gap too small to be one moves on to the next aligned address.
+ */
+static size_t align_padding(void *base, size_t offset, size_t alignment)
+{
+	size_t padding = -((size_t)base + offset + TAG_WORD) & (alignment - 1);
+
+	while (padding && padding < TAG_MIN_BLOCK)
+		padding += alignment;
+	return padding;
+}
+
+/* tag_malloc for a payload address that is a multiple of alignment, a power
+ * of two. Any padding in front of the block goes back to the free list.
+ */
+void *tag_memalign(void *base, strategies strategy, size_t alignment, size_t requested)
+{
+	struct tagHeap *heap = base;
+	size_t found = TAG_NIL;
+	size_t foundSize = 0;
+	size_t wrapped = TAG_NIL;
+
+	if (requested > heap->size)
+		return NULL;
+
+	// payload rounded up to whole words, plus the tags
+	size_t needed = ((requested + TAG_WORD - 1) & ~(TAG_WORD - 1)) + TAG_OVERHEAD;
+	if (needed < TAG_MIN_BLOCK)
+		needed = TAG_MIN_BLOCK;
+	if (alignment < TAG_WORD)
+		alignment = TAG_WORD;
+
+	// One pass over the free list; which fitting block wins depends on the strategy.
+	for (size_t offset = heap->freeHead; offset != TAG_NIL; offset = *next_free(base, offset))
+	{
+		size_t size = block_size(base, offset);
+		if (size < needed + align_padding(base, offset, alignment))
+			continue;
+
+		switch (strategy)
+		{
+		case First:
+		case Bitmap: // no bitmap in this layout; it places blocks like first fit
+			if (found == TAG_NIL || offset < found)
+				found = offset;
+			break;
+		case Best:
+		case TLSF: // no segregated lists in this layout; it places blocks like best fit
+			if (found == TAG_NIL || size < foundSize || (size == foundSize && offset < found))
+				found = offset;
+			break;
+		case Worst:
+			if (found == TAG_NIL || size > foundSize || (size == foundSize && offset < found))
+				found = offset;
+			break;
+		case Next:
+			// closest block at or after the rover, otherwise wrap around to the lowest address
+			if (offset >= heap->rover && (found == TAG_NIL || offset < found))
+				found = offset;
+			if (offset < heap->rover && (wrapped == TAG_NIL || offset < wrapped))
+				wrapped = offset;
+			break;
+		default:
+			return NULL;
+		}
+
+		if (found == offset)
+			foundSize = size;
+	}
+
+	if (found == TAG_NIL)
+		found = wrapped;
+	if (found == TAG_NIL)
+		return NULL;
+
+	size_t padding = align_padding(base, found, alignment);
+	size_t size = block_size(base, found) - padding;
+	size_t block = found + padding;
+	freelist_unlink(heap, found);
+
+	// split off the tail as a new free block when it is large enough to stand alone
+	if (size - needed >= TAG_MIN_BLOCK)
+	{
+		set_tags(base, block + needed, size - needed, 0);
+		freelist_push(heap, block + needed);
+		heap->tagBytes += TAG_OVERHEAD;
+		heap->blocks++;
+		size = needed;
+	}
+
+	set_tags(base, block, size, 1);
+
+	// the block in front of a free block is allocated, so the padding stays a hole of its own
+	if (padding)
+	{
+		set_tags(base, found, padding, 0);
+		freelist_push(heap, found);
+		heap->tagBytes += TAG_OVERHEAD;
+		heap->blocks++;
+	}
+
+	found = block;
+	heap->rover = found + size;
+	if (heap->rover == heap->end)
+		heap->rover = heap->firstBlock;
+
+	return (char *)base + found + TAG_WORD;
+}
+
+/* Offset of the allocated block whose payload starts at ptr, or TAG_NIL if ptr
+ * does not look like one. The check is the header and footer agreeing, so it
+ * is best-effort: it cannot see through a corrupted heap.
+ */
+static size_t allocated_block(struct tagHeap *heap, void *ptr)
+{
+	void *base = heap;
+	size_t offset = (char *)ptr - (char *)base - TAG_WORD;
+
+	if ((char *)ptr < (char *)base + heap->firstBlock + TAG_WORD || offset >= heap->end ||
+		(offset - heap->firstBlock) % TAG_WORD)
+		return TAG_NIL;
+
+	size_t size = block_size(base, offset);
+	if (!block_alloc(base, offset) || size < TAG_MIN_BLOCK || offset + size > heap->end ||
+		*tag_word(base, offset + size - TAG_WORD) != *tag_word(base, offset))
+		return TAG_NIL;
+
+	return offset;
+}
+
+// Payload bytes of the allocated block at ptr, or 0 if ptr is not one.
+size_t tag_usable_size(void *base, void *ptr)
+{
+	size_t offset = allocated_block(base, ptr);
+
+	return offset == TAG_NIL ? 0 : block_size(base, offset) - TAG_OVERHEAD;
+}
+
+/* Free the block whose payload starts at ptr. Returns -1 if ptr does not look
+ * like an allocated block of this heap.
+ */
+int tag_free(void *base, void *ptr)
+{
+	struct tagHeap *heap = base;
+	size_t offset = allocated_block(heap, ptr);
+
+	if (offset == TAG_NIL)
+		return -1;
+
+	size_t size = block_size(base, offset);
+
+	// merge with the previous block, found through its footer
+	if (offset > heap->firstBlock && !block_alloc(base, offset - TAG_WORD))
+	{
+		size_t prevSize = block_size(base, offset - TAG_WORD);
+		offset -= prevSize;
+		size += prevSize;
+		freelist_unlink(heap, offset);
+		heap->tagBytes -= TAG_OVERHEAD;
+		heap->blocks--;
+	}
+
+	// merge with the next block, found through this block's size
+	if (offset + size < heap->end && !block_alloc(base, offset + size))
+	{
+		freelist_unlink(heap, offset + size);
+		size += block_size(base, offset + size);
+		heap->tagBytes -= TAG_OVERHEAD;
+		heap->blocks--;
+	}
+
+	set_tags(base, offset, size, 0);
+	freelist_push(heap, offset);
+
+	// keep the next-fit rover on a block boundary
+	if (heap->rover > offset && heap->rover < offset + size)
+		heap->rover = offset;
+
+	return 0;
+}
+
+/* Resize the block whose payload starts at ptr without moving it. A shrunk
+ * block gives its tail to a free next block, or to a new free block if the
+ * tail can stand alone; a grown block takes what it needs from a free next
+ * block. Returns 1 if the block was resized, 0 if it cannot grow in place and
+ * -1 if ptr is not an allocated block. *oldSize is set to the payload size
+ * before the call.
+ */
+int tag_resize(void *base, void *ptr, size_t requested, size_t *oldSize)
+{
+	struct tagHeap *heap = base;
+	size_t offset = allocated_block(heap, ptr);
+
+	if (offset == TAG_NIL)
+		return -1;
+
+	size_t size = block_size(base, offset);
+	size_t next = offset + size;
+	int nextFree = next < heap->end && !block_alloc(base, next);
+	*oldSize = size - TAG_OVERHEAD;
+
+	if (requested > heap->size)
+		return 0;
+
+	size_t needed = ((requested + TAG_WORD - 1) & ~(TAG_WORD - 1)) + TAG_OVERHEAD;
+	if (needed < TAG_MIN_BLOCK)
+		needed = TAG_MIN_BLOCK;
+
+	// the block plus a free next block is the space to work with
+	size_t total = size;
+	if (needed > size && (!nextFree || size + block_size(base, next) < needed))
+		return 0;
+	if (nextFree)
+	{
+		total += block_size(base, next);
+		freelist_unlink(heap, next);
+		heap->tagBytes -= TAG_OVERHEAD;
+		heap->blocks--;
+	}
+
+	// what is left over becomes a free block when it is large enough to stand alone
+	if (needed <= total && total - needed >= TAG_MIN_BLOCK)
+	{
+		set_tags(base, offset + needed, total - needed, 0);
+		set_tags(base, offset, needed, 1);
+		freelist_push(heap, offset + needed);
+		heap->tagBytes += TAG_OVERHEAD;
+		heap->blocks++;
+		size = needed;
+	}
+	else
+	{
+		set_tags(base, offset, total, 1);
+		size = total;
+	}
+
+	// keep the next-fit rover on a block boundary
+	if (heap->rover > offset && heap->rover < offset + total && heap->rover != offset + size)
+		heap->rover = offset + size == heap->end ? heap->firstBlock : offset + size;
+
+	return 1;
+}
+
+/* Rebuild the tags, the free list and the counts after a process died while
+ * it was changing the heap. The blocks are walked by their headers, each
+ * footer is made to agree with its header, and neighbouring free blocks are
+ * merged; a change the process did not finish is thereby dropped. The walk
+ * stops at a header that cannot be one, and the heap ends there: nothing
+ * past it is handed out or freed again. Returns 0 if the whole heap was
+ * walked, -1 if part of it was given up.
+ */
+int tag_repair(void *base)
+{
+	struct tagHeap *heap = base;
+	size_t offset = heap->firstBlock;
+	size_t lastFree = TAG_NIL;
+
+	heap->freeHead = TAG_NIL;
+	heap->freeBytes = 0;
+	heap->tagBytes = 0;
+	heap->freeBlocks = 0;
+	heap->blocks = 0;
+	heap->rover = heap->firstBlock;
+
+	while (offset < heap->end)
+	{
+		size_t size = block_size(base, offset);
+		if (size < TAG_MIN_BLOCK || size % TAG_WORD || size > heap->end - offset)
+			break;
+
+		if (block_alloc(base, offset))
+		{
+			set_tags(base, offset, size, 1);
+			lastFree = TAG_NIL;
+		}
+		else if (lastFree != TAG_NIL)
+		{
+			freelist_unlink(heap, lastFree);
+			set_tags(base, lastFree, offset + size - lastFree, 0);
+			freelist_push(heap, lastFree);
+			offset += size;
+			continue;
+		}
+		else
+		{
+			set_tags(base, offset, size, 0);
+			freelist_push(heap, offset);
+			lastFree = offset;
+		}
+		heap->tagBytes += TAG_OVERHEAD;
+		heap->blocks++;
+		offset += size;
+	}
+
+	if (offset == heap->end)
+		return 0;
+	heap->end = offset;
+	return -1;
+}
+
+/* Give the whole pages inside free blocks of at least minSize bytes back to
+ * the OS. The header and free-list links at the start of a block and its
+ * footer stay resident. Returns the bytes given back.
+ */
+size_t tag_trim(void *base, size_t minSize)
+{
+	struct tagHeap *heap = base;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t released = 0;
+
+	for (size_t offset = heap->freeHead; offset != TAG_NIL; offset = *next_free(base, offset))
+	{
+		if (block_size(base, offset) < minSize)
+			continue;
+
+		size_t from = ((size_t)base + offset + 3 * TAG_WORD + page - 1) & ~(page - 1);
+		size_t to = ((size_t)base + offset + block_size(base, offset) - TAG_WORD) & ~(page - 1);
+		if (from < to && !madvise((void *)from, to - from, MADV_DONTNEED))
+			released += to - from;
+	}
+	return released;
+}
+
+int tag_holes(void *base)
+{
+	return ((struct tagHeap *)base)->freeBlocks;
+}
+
+size_t tag_free_bytes(void *base)
+{
+	return ((struct tagHeap *)base)->freeBytes;
+}
+
+// Payload bytes of allocated blocks, word rounding included.
+size_t tag_allocated(void *base)
+{
+	struct tagHeap *heap = base;
+	return heap->end - heap->firstBlock - heap->tagBytes - heap->freeBytes;
+}
+
+// Largest request a single free block could serve.
+size_t tag_largest_free(void *base)
+{
+	struct tagHeap *heap = base;
+	size_t largest = 0;
+
+	for (size_t offset = heap->freeHead; offset != TAG_NIL; offset = *next_free(base, offset))
+	{
+		if (block_size(base, offset) - TAG_OVERHEAD > largest)
+			largest = block_size(base, offset) - TAG_OVERHEAD;
+	}
+	return largest;
+}
+
+int tag_small_free(void *base, int size)
+{
+	struct tagHeap *heap = base;
+	int count = 0;
+
+	for (size_t offset = heap->freeHead; offset != TAG_NIL; offset = *next_free(base, offset))
+	{
+		if (size >= 0 && block_size(base, offset) - TAG_OVERHEAD <= (size_t)size)
+			count++;
+	}
+	return count;
+}
+
+int tag_hole_histogram(void *base, int *counts, int buckets)
+{
+	struct tagHeap *heap = base;
+
+	memset(counts, 0, buckets * sizeof(int));
+	for (size_t offset = heap->freeHead; offset != TAG_NIL; offset = *next_free(base, offset))
+	{
+		int log = 63 - __builtin_clzll(block_size(base, offset) - TAG_OVERHEAD);
+		counts[log < buckets ? log : buckets - 1]++;
+	}
+	return heap->freeBlocks;
+}
+
+/* Bytes that mymalloc can not hand out (heap state, tags, the unused tail of
+ * the region) count as allocated; only the payload of free blocks is free.
+ */
+char tag_is_alloc(void *base, void *ptr)
+{
+	struct tagHeap *heap = base;
+	size_t target = (char *)ptr - (char *)base;
+
+	if (target < heap->firstBlock || target >= heap->end)
+		return 1;
+
+	// walk the implicit list of blocks by their sizes
+	size_t offset = heap->firstBlock;
+	while (offset + block_size(base, offset) <= target)
+		offset += block_size(base, offset);
+
+	if (block_alloc(base, offset))
+		return 1;
+	return target < offset + TAG_WORD || target >= offset + block_size(base, offset) - TAG_WORD;
+}
+
+int tag_is_alloc_range(void *base, void *ptr, size_t len)
+{
+	struct tagHeap *heap = base;
+	size_t start = (char *)ptr - (char *)base;
+	size_t end = start + len;
+	int sawAlloc = 0;
+	int sawFree = 0;
+
+	if ((char *)ptr < (char *)base || len == 0 || end > heap->size)
+		return MEM_RANGE_INVALID;
+
+	// everything outside the blocks is reserved
+	if (start < heap->firstBlock || end > heap->end)
+		sawAlloc = 1;
+
+	for (size_t offset = heap->firstBlock; offset < heap->end && offset < end; offset += block_size(base, offset))
+	{
+		size_t size = block_size(base, offset);
+		if (offset + size <= start)
+			continue;
+
+		if (block_alloc(base, offset))
+		{
+			sawAlloc = 1;
+			continue;
+		}
+
+		// a free block is free in its payload and reserved in its tags
+		size_t lo = start > offset ? start : offset;
+		size_t hi = end < offset + size ? end : offset + size;
+		if (lo < offset + TAG_WORD || hi > offset + size - TAG_WORD)
+			sawAlloc = 1;
+		if (lo < offset + size - TAG_WORD && hi > offset + TAG_WORD)
+			sawFree = 1;
+	}
+
+	if (sawAlloc && sawFree)
+		return MEM_RANGE_MIXED;
+	return sawAlloc ? MEM_RANGE_ALLOC : MEM_RANGE_FREE;
+}
+
+// Bytes of the region spent on bookkeeping: heap state, tags and the unusable tail.
+size_t tag_overhead(void *base)
+{
+	struct tagHeap *heap = base;
+	return heap->firstBlock + heap->tagBytes + (heap->size - heap->end);
+}
+
+void tag_print(void *base)
+{
+	struct tagHeap *heap = base;
+
+	printf("Memory List (boundary tags) {\n");
+	for (size_t offset = heap->firstBlock; offset < heap->end; offset += block_size(base, offset))
+	{
+		printf("\tBlock %p,\tsize %zu,\t%s\n",
+			   (char *)base + offset + TAG_WORD,
+			   block_size(base, offset) - TAG_OVERHEAD,
+			   (block_alloc(base, offset) ? "[ALLOCATED]" : "[FREE]"));
+	}
+	printf("}\n");
+}
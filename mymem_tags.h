@@ -0,0 +1,27 @@
+#include <stddef.h>
+
+/* In-band boundary-tag heap (TagLayout).
+ * Every block carries a header and a footer word holding its size and
+ * allocation bit, and the heap state itself sits at the start of the region.
+ * All links are offsets from the region base, so nothing in the region
+ * depends on where it is mapped.
+ */
+void tag_init(void *base, size_t sz);
+void *tag_malloc(void *base, strategies strategy, size_t requested);
+void *tag_memalign(void *base, strategies strategy, size_t alignment, size_t requested);
+int tag_free(void *base, void *ptr);
+int tag_resize(void *base, void *ptr, size_t requested, size_t *oldSize);
+size_t tag_usable_size(void *base, void *ptr);
+size_t tag_trim(void *base, size_t minSize);
+int tag_repair(void *base);
+
+int tag_holes(void *base);
+size_t tag_allocated(void *base);
+size_t tag_free_bytes(void *base);
+size_t tag_largest_free(void *base);
+int tag_small_free(void *base, int size);
+int tag_hole_histogram(void *base, int *counts, int buckets);
+char tag_is_alloc(void *base, void *ptr);
+int tag_is_alloc_range(void *base, void *ptr, size_t len);
+size_t tag_overhead(void *base);
+void tag_print(void *base);